@@ -159,3 +159,74 @@ AVLNode *avl_offset(AVLNode *node, int64_t offset) {
     }
     return node;
 }
+
+// a walk goes on to the right child of every node it stops at, so load
+// those ahead; the loads overlap instead of missing one after another
+AVLNode *avl_next(AVLNode *node) {
+    if (node->right) {
+        node = node->right;
+        __builtin_prefetch(node->right);
+        while (node->left) {
+            node = node->left;
+            __builtin_prefetch(node->right);
+        }
+        return node;
+    }
+    while (node->parent && node->parent->right == node) {
+        node = node->parent;
+    }
+    node = node->parent;
+    if (node) {
+        __builtin_prefetch(node->right);
+    }
+    return node;
+}
+
+AVLNode *avl_prev(AVLNode *node) {
+    if (node->left) {
+        node = node->left;
+        __builtin_prefetch(node->left);
+        while (node->right) {
+            node = node->right;
+            __builtin_prefetch(node->left);
+        }
+        return node;
+    }
+    while (node->parent && node->parent->left == node) {
+        node = node->parent;
+    }
+    node = node->parent;
+    if (node) {
+        __builtin_prefetch(node->left);
+    }
+    return node;
+}
+
+AVLNode *avl_build(AVLNode **nodes, size_t n) {
+    if (n == 0) {
+        return NULL;
+    }
+    size_t mid = n / 2;
+    AVLNode *root = nodes[mid];
+    root->parent = NULL;
+    root->left = avl_build(nodes, mid);
+    root->right = avl_build(nodes + mid + 1, n - mid - 1);
+    if (root->left) {
+        root->left->parent = root;
+    }
+    if (root->right) {
+        root->right->parent = root;
+    }
+    avl_update(root);
+    return root;
+}
+
+uint64_t avl_rank(AVLNode *node) {
+    uint64_t rank = avl_cnt(node->left);
+    for (; node->parent; node = node->parent) {
+        if (node->parent->right == node) {
+            rank += avl_cnt(node->parent->left) + 1;
+        }
+    }
+    return rank;
+}
@@ -21,3 +21,12 @@ inline void avl_init(AVLNode *node) {
 AVLNode *avl_fix(AVLNode *node);
 AVLNode *avl_del(AVLNode *node);
 AVLNode *avl_offset(AVLNode *node, int64_t offset);
+// the in-order neighbours, NULL past either end. amortized O(1) over a
+// walk, where avl_offset(+1) pays for the counts at every step.
+AVLNode *avl_next(AVLNode *node);
+AVLNode *avl_prev(AVLNode *node);
+// a balanced tree of `n` nodes given in order, returns the root. the
+// nodes' own links are overwritten.
+AVLNode *avl_build(AVLNode **nodes, size_t n);
+// the number of nodes before it in the whole tree
+uint64_t avl_rank(AVLNode *node);
@@ -0,0 +1,702 @@
+// load generator: persistent connections from several threads, each
+// keeping `depth` requests in flight, over a weighted mix of every
+// command. reports throughput and latency percentiles per command.
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+#include "protocol.h"
+
+
+enum {
+    C_GET, C_SET, C_DEL, C_PEXPIRE, C_PTTL,
+    C_ZADD, C_ZREM, C_ZSCORE, C_ZQUERY,
+    C_INCR,
+    C_NCMDS,
+};
+
+static const char *k_names[C_NCMDS] = {
+    "get", "set", "del", "pexpire", "pttl",
+    "zadd", "zrem", "zscore", "zquery",
+    "incr",
+};
+
+// a size drawn uniformly from [lo, hi]
+struct SizeDist {
+    uint32_t lo = 0;
+    uint32_t hi = 0;
+};
+
+struct Options {
+    uint16_t port = 1234;
+    int threads = 4;
+    int conns = 8;          // per thread
+    int depth = 1;          // requests in flight per connection
+    uint64_t total = 1000000;
+    uint32_t keys = 100000;     // string keyspace
+    uint32_t zkeys = 1000;      // sorted set keyspace
+    uint32_t members = 1000;    // per sorted set
+    double theta = 0.99;        // zipfian skew, 0 for uniform
+    SizeDist ksize = {16, 16};
+    SizeDist vsize = {32, 256};
+    uint32_t weights[C_NCMDS] = {30, 20, 5, 5, 5, 15, 5, 10, 5, 0};
+    bool prefill = false;
+    const char *csv = NULL;
+};
+
+static Options g_opts;
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+// xorshift64*, one per thread
+struct Rng {
+    uint64_t s;
+};
+
+static uint64_t rng_next(Rng &r) {
+    r.s ^= r.s >> 12;
+    r.s ^= r.s << 25;
+    r.s ^= r.s >> 27;
+    return r.s * 0x2545F4914F6CDD1Dull;
+}
+
+static double rng_unit(Rng &r) {
+    return (double)(rng_next(r) >> 11) / (double)(1ull << 53);
+}
+
+static uint32_t rng_range(Rng &r, uint32_t lo, uint32_t hi) {
+    return lo + (uint32_t)(rng_next(r) % ((uint64_t)hi - lo + 1));
+}
+
+// zipfian over [0, n) as in YCSB (Gray et al.), scrambled so the hot
+// keys don't all land next to each other. the method only holds for
+// 0 < theta < 1, so --zipf refuses anything from 1 up.
+struct Zipf {
+    uint64_t n = 0;
+    double theta = 0;
+    double alpha = 0;
+    double zetan = 0;
+    double eta = 0;
+};
+
+static void zipf_init(Zipf &z, uint64_t n, double theta) {
+    z.n = n;
+    z.theta = theta;
+    if (theta <= 0) {
+        return;
+    }
+    double zeta2 = 0;
+    for (uint64_t i = 1; i <= n; ++i) {
+        z.zetan += 1.0 / pow((double)i, theta);
+        if (i == 2) {
+            zeta2 = z.zetan;
+        }
+    }
+    z.alpha = 1.0 / (1.0 - theta);
+    z.eta = (1 - pow(2.0 / (double)n, 1 - theta)) / (1 - zeta2 / z.zetan);
+}
+
+static uint64_t zipf_next(const Zipf &z, Rng &r) {
+    if (z.theta <= 0) {
+        return rng_next(r) % z.n;
+    }
+    double u = rng_unit(r);
+    double uz = u * z.zetan;
+    uint64_t v = 0;
+    if (uz < 1.0) {
+        v = 0;
+    } else if (uz < 1.0 + pow(0.5, z.theta)) {
+        v = 1;
+    } else {
+        v = (uint64_t)((double)z.n * pow(z.eta * u - z.eta + 1, z.alpha));
+    }
+    if (v >= z.n) {
+        v = z.n - 1;
+    }
+    return (v * 0x9E3779B97F4A7C15ull) % z.n;
+}
+
+static Zipf g_keys_zipf;
+static Zipf g_zkeys_zipf;
+static std::string g_value;     // values are slices of this
+
+struct BConn {
+    int fd = -1;
+    std::string out;            // requests not written yet
+    std::string in;             // replies not parsed yet
+    std::deque<std::pair<uint64_t, uint8_t>> sent;  // send time, command
+    bool want_write = false;
+};
+
+struct Worker {
+    pthread_t th;
+    int id = 0;
+    uint64_t quota = 0;     // requests to send
+    uint64_t sent = 0;
+    uint64_t done = 0;
+    uint64_t errors = 0;    // SER_ERR replies
+    Rng rng;
+    std::vector<uint64_t> lat[C_NCMDS];
+};
+
+static void put_u32(std::string &out, uint32_t v) {
+    out.append((char *)&v, 4);
+}
+
+// append one request frame
+static void encode(std::string &out, const std::string *args, size_t n) {
+    uint32_t len = 4;
+    for (size_t i = 0; i < n; ++i) {
+        len += 4 + (uint32_t)args[i].size();
+    }
+    put_u32(out, len);
+    put_u32(out, (uint32_t)n);
+    for (size_t i = 0; i < n; ++i) {
+        put_u32(out, (uint32_t)args[i].size());
+        out.append(args[i]);
+    }
+}
+
+// string keys are padded to a size fixed per key
+static uint32_t key_size(uint64_t idx) {
+    const SizeDist &d = g_opts.ksize;
+    return d.lo + (uint32_t)((idx * 0x9E3779B97F4A7C15ull >> 32) % (d.hi - d.lo + 1));
+}
+
+static std::string make_key(char prefix, uint64_t idx, uint32_t size) {
+    char buf[32];
+    int n = snprintf(buf, sizeof(buf), "%c%llu", prefix, (unsigned long long)idx);
+    std::string key(buf, n);
+    if (key.size() < size) {
+        key.append(size - key.size(), '.');
+    }
+    return key;
+}
+
+static uint8_t pick_cmd(Rng &r) {
+    uint32_t sum = 0;
+    for (int i = 0; i < C_NCMDS; ++i) {
+        sum += g_opts.weights[i];
+    }
+    uint32_t x = (uint32_t)(rng_next(r) % sum);
+    for (int i = 0; i < C_NCMDS; ++i) {
+        if (x < g_opts.weights[i]) {
+            return (uint8_t)i;
+        }
+        x -= g_opts.weights[i];
+    }
+    return C_GET;
+}
+
+// string, counter and sorted set commands use separate keys, so no
+// type errors
+static uint8_t gen_request(Worker &w, std::string &out) {
+    Rng &r = w.rng;
+    uint8_t cmd = pick_cmd(r);
+    std::string args[7];
+    args[0] = k_names[cmd];
+    size_t n = 0;
+    if (cmd <= C_PTTL) {
+        uint64_t idx = zipf_next(g_keys_zipf, r);
+        args[1] = make_key('k', idx, key_size(idx));
+    } else if (cmd == C_INCR) {
+        uint64_t idx = zipf_next(g_keys_zipf, r);
+        args[1] = make_key('c', idx, key_size(idx));
+    } else {
+        args[1] = make_key('z', zipf_next(g_zkeys_zipf, r), 0);
+    }
+    std::string member = make_key('m', rng_next(r) % g_opts.members, 0);
+    switch (cmd) {
+    case C_GET:
+    case C_DEL:
+    case C_PTTL:
+    case C_INCR:
+        n = 2;
+        break;
+    case C_SET: {
+        uint32_t vsize = rng_range(r, g_opts.vsize.lo, g_opts.vsize.hi);
+        size_t off = rng_next(r) % (g_value.size() - vsize + 1);
+        args[2] = g_value.substr(off, vsize);
+        n = 3;
+        break;
+    }
+    case C_PEXPIRE:
+        args[2] = std::to_string(rng_range(r, 1000, 5000));
+        n = 3;
+        break;
+    case C_ZADD:
+        args[2] = std::to_string(rng_range(r, 0, 1000));
+        args[3] = member;
+        n = 4;
+        break;
+    case C_ZREM:
+    case C_ZSCORE:
+        args[2] = member;
+        n = 3;
+        break;
+    case C_ZQUERY:
+        args[2] = std::to_string(rng_range(r, 0, 1000));
+        args[3] = "";
+        args[4] = "0";
+        args[5] = "10";
+        n = 6;
+        break;
+    }
+    encode(out, args, n);
+    return cmd;
+}
+
+static int connect_to(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static bool conn_flush(BConn &c) {
+    while (!c.out.empty()) {
+        ssize_t rv = write(c.fd, c.out.data(), c.out.size());
+        if (rv < 0 && errno == EAGAIN) {
+            return true;
+        }
+        if (rv <= 0) {
+            return false;
+        }
+        c.out.erase(0, (size_t)rv);
+    }
+    return true;
+}
+
+static void conn_refill(Worker &w, BConn &c) {
+    while (c.sent.size() < (size_t)g_opts.depth && w.sent < w.quota) {
+        uint8_t cmd = gen_request(w, c.out);
+        c.sent.emplace_back(now_ns(), cmd);
+        w.sent++;
+    }
+}
+
+// returns false on a broken connection
+static bool conn_read(Worker &w, BConn &c) {
+    char buf[64 * 1024];
+    while (true) {
+        ssize_t rv = read(c.fd, buf, sizeof(buf));
+        if (rv < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (rv <= 0) {
+            return false;
+        }
+        c.in.append(buf, (size_t)rv);
+    }
+    uint64_t now = now_ns();
+    size_t pos = 0;
+    while (c.in.size() - pos >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, &c.in[pos], 4);
+        if (c.in.size() - pos - 4 < len) {
+            break;
+        }
+        if (c.sent.empty()) {
+            return false;   // a reply nobody asked for
+        }
+        if (len > 0 && c.in[pos + 4] == SER_ERR) {
+            w.errors++;
+        }
+        std::pair<uint64_t, uint8_t> req = c.sent.front();
+        c.sent.pop_front();
+        w.lat[req.second].push_back(now - req.first);
+        w.done++;
+        pos += 4 + (size_t)len;
+    }
+    c.in.erase(0, pos);
+    return true;
+}
+
+static void *worker_main(void *arg) {
+    Worker &w = *(Worker *)arg;
+    int epfd = epoll_create1(0);
+    std::vector<BConn> conns(g_opts.conns);
+    for (size_t i = 0; i < conns.size(); ++i) {
+        BConn &c = conns[i];
+        c.fd = connect_to(g_opts.port);
+        if (c.fd < 0) {
+            perror("connect");
+            exit(1);
+        }
+        int flags = fcntl(c.fd, F_GETFL, 0);
+        fcntl(c.fd, F_SETFL, flags | O_NONBLOCK);
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c.fd, &ev);
+    }
+
+    for (BConn &c : conns) {
+        conn_refill(w, c);
+        if (!conn_flush(c)) {
+            perror("write");
+            exit(1);
+        }
+    }
+    std::vector<struct epoll_event> events(conns.size());
+    while (w.done < w.quota) {
+        int rv = epoll_wait(epfd, events.data(), (int)events.size(), 1000);
+        if (rv < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            exit(1);
+        }
+        for (int i = 0; i < rv; ++i) {
+            BConn &c = conns[events[i].data.u64];
+            if ((events[i].events & EPOLLIN) && !conn_read(w, c)) {
+                fprintf(stderr, "connection lost\n");
+                exit(1);
+            }
+            conn_refill(w, c);
+            if (!conn_flush(c)) {
+                perror("write");
+                exit(1);
+            }
+            // only wait for writability while something is stuck
+            bool want = !c.out.empty();
+            if (want != c.want_write) {
+                struct epoll_event ev = {};
+                ev.events = EPOLLIN | (want ? (uint32_t)EPOLLOUT : 0);
+                ev.data.u64 = events[i].data.u64;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, c.fd, &ev);
+                c.want_write = want;
+            }
+        }
+    }
+    for (BConn &c : conns) {
+        close(c.fd);
+    }
+    close(epfd);
+    return NULL;
+}
+
+static void write_all(int fd, const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t rv = write(fd, &data[off], data.size() - off);
+        if (rv <= 0) {
+            perror("write");
+            exit(1);
+        }
+        off += (size_t)rv;
+    }
+}
+
+static void read_all(int fd, void *buf, size_t n) {
+    size_t off = 0;
+    while (off < n) {
+        ssize_t rv = read(fd, (char *)buf + off, n - off);
+        if (rv <= 0) {
+            perror("read");
+            exit(1);
+        }
+        off += (size_t)rv;
+    }
+}
+
+// the server's heap bytes in use, -1 if it doesn't say
+static int64_t server_memused(int fd) {
+    std::string out;
+    std::string arg = "memused";
+    encode(out, &arg, 1);
+    write_all(fd, out);
+    uint32_t len = 0;
+    read_all(fd, &len, 4);
+    std::vector<uint8_t> res(len);
+    read_all(fd, res.data(), len);
+    int64_t used = -1;
+    if (len == 9 && res[0] == SER_INT) {
+        memcpy(&used, &res[1], 8);
+    }
+    return used;
+}
+
+// SET every string key once, so GETs hit. prints the heap bytes each
+// key added, the server's cost per key at these sizes.
+static void prefill() {
+    int fd = connect_to(g_opts.port);
+    if (fd < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int64_t used0 = server_memused(fd);
+    Rng r = {42};
+    const uint32_t k_batch = 1000;
+    for (uint32_t base = 0; base < g_opts.keys; base += k_batch) {
+        std::string out;
+        uint32_t n = std::min(k_batch, g_opts.keys - base);
+        for (uint32_t i = 0; i < n; ++i) {
+            std::string args[3];
+            args[0] = "set";
+            args[1] = make_key('k', base + i, key_size(base + i));
+            uint32_t vsize = rng_range(r, g_opts.vsize.lo, g_opts.vsize.hi);
+            args[2] = g_value.substr(0, vsize);
+            encode(out, args, 3);
+        }
+        write_all(fd, out);
+        // replies to SET are 5 bytes each
+        size_t want = (size_t)n * 5;
+        char buf[4096];
+        while (want > 0) {
+            size_t chunk = std::min(want, sizeof(buf));
+            read_all(fd, buf, chunk);
+            want -= chunk;
+        }
+    }
+    int64_t used1 = server_memused(fd);
+    if (used0 >= 0 && used1 >= 0 && g_opts.keys > 0) {
+        printf("prefill: %u keys, %.1f heap bytes/key\n", g_opts.keys,
+            double(used1 - used0) / double(g_opts.keys));
+    }
+    close(fd);
+}
+
+static bool parse_size(const char *s, SizeDist &d) {
+    char *end = NULL;
+    unsigned long lo = strtoul(s, &end, 10);
+    unsigned long hi = lo;
+    if (*end == '-') {
+        hi = strtoul(end + 1, &end, 10);
+    }
+    if (*end || lo > hi || hi > (1u << 24)) {
+        return false;
+    }
+    d.lo = (uint32_t)lo;
+    d.hi = (uint32_t)hi;
+    return true;
+}
+
+// "get=50,set=50", commands left out get weight 0
+static bool parse_mix(const char *s, uint32_t *weights) {
+    for (int i = 0; i < C_NCMDS; ++i) {
+        weights[i] = 0;
+    }
+    std::string mix(s);
+    size_t pos = 0;
+    uint32_t sum = 0;
+    while (pos < mix.size()) {
+        size_t comma = mix.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = mix.size();
+        }
+        std::string item = mix.substr(pos, comma - pos);
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string name = item.substr(0, eq);
+        int i = 0;
+        while (i < C_NCMDS && name != k_names[i]) {
+            i++;
+        }
+        if (i == C_NCMDS) {
+            return false;
+        }
+        weights[i] = (uint32_t)atoi(item.c_str() + eq + 1);
+        sum += weights[i];
+        pos = comma + 1;
+    }
+    return sum > 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -p PORT          server port (1234)\n"
+        "  -t THREADS       client threads (4)\n"
+        "  -c CONNS         connections per thread (8)\n"
+        "  -d DEPTH         pipelined requests per connection (1)\n"
+        "  -n REQUESTS      total requests (1000000)\n"
+        "  -k KEYS          string keys (100000)\n"
+        "  --zkeys N        sorted set keys (1000)\n"
+        "  --members N      members per sorted set (1000)\n"
+        "  --zipf THETA     key popularity skew in [0, 1), 0 for uniform (0.99)\n"
+        "  --ksize N|A-B    key size in bytes (16)\n"
+        "  --vsize N|A-B    value size in bytes (32-256)\n"
+        "  --mix CMD=W,...  command weights (get=30,set=20,del=5,pexpire=5,\n"
+        "                   pttl=5,zadd=15,zrem=5,zscore=10,zquery=5,incr=0)\n"
+        "  --prefill        SET every string key before starting\n"
+        "  --csv FILE       append the results to FILE\n",
+        prog);
+    exit(1);
+}
+
+static double pct_us(const std::vector<uint64_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    return (double)v[(size_t)(p * (double)(v.size() - 1))] / 1e3;
+}
+
+int main(int argc, char **argv) {
+    Options &o = g_opts;
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+        bool ok = true;
+        if (0 == strcmp(a, "--prefill")) {
+            o.prefill = true;
+            continue;
+        }
+        if (!v) {
+            usage(argv[0]);
+        }
+        if (0 == strcmp(a, "-p")) {
+            o.port = (uint16_t)atoi(v);
+        } else if (0 == strcmp(a, "-t")) {
+            o.threads = atoi(v);
+        } else if (0 == strcmp(a, "-c")) {
+            o.conns = atoi(v);
+        } else if (0 == strcmp(a, "-d")) {
+            o.depth = atoi(v);
+        } else if (0 == strcmp(a, "-n")) {
+            o.total = strtoull(v, NULL, 10);
+        } else if (0 == strcmp(a, "-k")) {
+            o.keys = (uint32_t)atoi(v);
+        } else if (0 == strcmp(a, "--zkeys")) {
+            o.zkeys = (uint32_t)atoi(v);
+        } else if (0 == strcmp(a, "--members")) {
+            o.members = (uint32_t)atoi(v);
+        } else if (0 == strcmp(a, "--zipf")) {
+            o.theta = atof(v);
+        } else if (0 == strcmp(a, "--ksize")) {
+            ok = parse_size(v, o.ksize);
+        } else if (0 == strcmp(a, "--vsize")) {
+            ok = parse_size(v, o.vsize);
+        } else if (0 == strcmp(a, "--mix")) {
+            ok = parse_mix(v, o.weights);
+        } else if (0 == strcmp(a, "--csv")) {
+            o.csv = v;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            usage(argv[0]);
+        }
+        i++;
+    }
+    if (o.threads <= 0 || o.conns <= 0 || o.depth <= 0 || o.total == 0
+        || o.keys == 0 || o.zkeys == 0 || o.members == 0
+        || !(o.theta >= 0 && o.theta < 1))
+    {
+        usage(argv[0]);
+    }
+
+    g_value.resize(o.vsize.hi * 2 + 1);
+    Rng vr = {7};
+    for (char &ch : g_value) {
+        ch = (char)('a' + rng_next(vr) % 26);
+    }
+    zipf_init(g_keys_zipf, o.keys, o.theta);
+    zipf_init(g_zkeys_zipf, o.zkeys, o.theta);
+    if (o.prefill) {
+        prefill();
+    }
+
+    std::vector<Worker> workers(o.threads);
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < o.threads; ++i) {
+        Worker &w = workers[i];
+        w.id = i;
+        w.quota = o.total / o.threads + (i < (int)(o.total % o.threads) ? 1 : 0);
+        w.rng.s = 0x9E3779B97F4A7C15ull * (i + 1);
+        if (pthread_create(&w.th, NULL, &worker_main, &w)) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    std::vector<uint64_t> lat[C_NCMDS];
+    std::vector<uint64_t> all;
+    uint64_t errors = 0;
+    for (Worker &w : workers) {
+        pthread_join(w.th, NULL);
+        for (int c = 0; c < C_NCMDS; ++c) {
+            lat[c].insert(lat[c].end(), w.lat[c].begin(), w.lat[c].end());
+        }
+        errors += w.errors;
+    }
+    double secs = (double)(now_ns() - t0) / 1e9;
+    for (int c = 0; c < C_NCMDS; ++c) {
+        std::sort(lat[c].begin(), lat[c].end());
+        all.insert(all.end(), lat[c].begin(), lat[c].end());
+    }
+    std::sort(all.begin(), all.end());
+
+    printf("%zu requests in %.3f s, %d threads x %d conns, depth %d\n",
+        all.size(), secs, o.threads, o.conns, o.depth);
+    printf("throughput: %.0f req/s, %llu error replies\n",
+        (double)all.size() / secs, (unsigned long long)errors);
+    printf("%-8s %10s %10s %10s %10s\n", "cmd", "count", "p50 us", "p99 us", "p999 us");
+    for (int c = 0; c < C_NCMDS; ++c) {
+        if (lat[c].empty()) {
+            continue;
+        }
+        printf("%-8s %10zu %10.1f %10.1f %10.1f\n", k_names[c], lat[c].size(),
+            pct_us(lat[c], 0.50), pct_us(lat[c], 0.99), pct_us(lat[c], 0.999));
+    }
+    printf("%-8s %10zu %10.1f %10.1f %10.1f\n", "all", all.size(),
+        pct_us(all, 0.50), pct_us(all, 0.99), pct_us(all, 0.999));
+
+    if (o.csv) {
+        FILE *f = fopen(o.csv, "a");
+        if (!f) {
+            perror("fopen");
+            return 1;
+        }
+        fseek(f, 0, SEEK_END);
+        if (ftell(f) == 0) {
+            fprintf(f, "timestamp,threads,conns,depth,requests,seconds,req_per_s,"
+                "command,count,p50_us,p99_us,p999_us\n");
+        }
+        time_t now = time(NULL);
+        char ts[32];
+        strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", localtime(&now));
+        for (int c = 0; c <= C_NCMDS; ++c) {
+            const std::vector<uint64_t> &v = c < C_NCMDS ? lat[c] : all;
+            if (v.empty()) {
+                continue;
+            }
+            fprintf(f, "%s,%d,%d,%d,%zu,%.3f,%.0f,%s,%zu,%.1f,%.1f,%.1f\n",
+                ts, o.threads, o.conns, o.depth, all.size(), secs,
+                (double)all.size() / secs, c < C_NCMDS ? k_names[c] : "all",
+                v.size(), pct_us(v, 0.50), pct_us(v, 0.99), pct_us(v, 0.999));
+        }
+        fclose(f);
+    }
+    return 0;
+}
@@ -0,0 +1,191 @@
+// connect storm: every thread opens a burst of connections at once,
+// sends one GET on each, waits for the replies and closes them again.
+// reports connections per second and the connect-to-reply latency.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+
+struct Options {
+    uint16_t port = 1234;
+    int threads = 4;
+    int burst = 256;        // connections open at once per thread
+    int total = 100000;     // connections over all threads
+};
+
+struct Worker {
+    pthread_t th;
+    int rounds = 0;
+    const Options *opts = NULL;
+    std::vector<uint64_t> lat_ns;
+    uint64_t errors = 0;
+};
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static bool write_all(int fd, const char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = write(fd, buf, n);
+        if (rv <= 0) {
+            return false;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    return true;
+}
+
+static bool read_full(int fd, char *buf, size_t n) {
+    while (n > 0) {
+        ssize_t rv = read(fd, buf, n);
+        if (rv <= 0) {
+            return false;
+        }
+        n -= (size_t)rv;
+        buf += rv;
+    }
+    return true;
+}
+
+static std::string encode_get(const char *key) {
+    uint32_t nstr = 2;
+    uint32_t len3 = 3;
+    uint32_t klen = (uint32_t)strlen(key);
+    uint32_t total = 4 + 4 + 3 + 4 + klen;
+    std::string req;
+    req.append((char *)&total, 4);
+    req.append((char *)&nstr, 4);
+    req.append((char *)&len3, 4);
+    req.append("get", 3);
+    req.append((char *)&klen, 4);
+    req.append(key, klen);
+    return req;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = (Worker *)arg;
+    const Options &opts = *w->opts;
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opts.port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    std::string req = encode_get("storm");
+
+    std::vector<int> fds(opts.burst);
+    std::vector<uint64_t> start(opts.burst);
+    for (int round = 0; round < w->rounds; ++round) {
+        // the handshakes complete in the kernel, the server sees a full backlog
+        for (int i = 0; i < opts.burst; ++i) {
+            start[i] = now_ns();
+            fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+            if (fds[i] < 0 || connect(fds[i], (struct sockaddr *)&addr, sizeof(addr))) {
+                w->errors++;
+                if (fds[i] >= 0) {
+                    close(fds[i]);
+                }
+                fds[i] = -1;
+                continue;
+            }
+            int one = 1;
+            setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (!write_all(fds[i], req.data(), req.size())) {
+                w->errors++;
+            }
+        }
+        for (int i = 0; i < opts.burst; ++i) {
+            if (fds[i] < 0) {
+                continue;
+            }
+            char hdr[4];
+            uint32_t len = 0;
+            char body[64];
+            if (!read_full(fds[i], hdr, 4)) {
+                w->errors++;
+            } else {
+                memcpy(&len, hdr, 4);
+                if (len > sizeof(body) || !read_full(fds[i], body, len)) {
+                    w->errors++;
+                } else {
+                    w->lat_ns.push_back(now_ns() - start[i]);
+                }
+            }
+            close(fds[i]);
+        }
+    }
+    return NULL;
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    size_t idx = (size_t)(p * (double)(v.size() - 1));
+    return v[idx];
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "-p") && i + 1 < argc) {
+            opts.port = (uint16_t)atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "-t") && i + 1 < argc) {
+            opts.threads = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "-b") && i + 1 < argc) {
+            opts.burst = atoi(argv[++i]);
+        } else if (0 == strcmp(argv[i], "-n") && i + 1 < argc) {
+            opts.total = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-p PORT] [-t THREADS] [-b BURST] [-n TOTAL]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (opts.threads <= 0 || opts.burst <= 0 || opts.total <= 0) {
+        fprintf(stderr, "bad arguments\n");
+        return 1;
+    }
+
+    int per_round = opts.threads * opts.burst;
+    int rounds = (opts.total + per_round - 1) / per_round;
+    std::vector<Worker> workers(opts.threads);
+    uint64_t t0 = now_ns();
+    for (Worker &w : workers) {
+        w.rounds = rounds;
+        w.opts = &opts;
+        if (pthread_create(&w.th, NULL, &worker_main, &w)) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    std::vector<uint64_t> lat;
+    uint64_t errors = 0;
+    for (Worker &w : workers) {
+        pthread_join(w.th, NULL);
+        lat.insert(lat.end(), w.lat_ns.begin(), w.lat_ns.end());
+        errors += w.errors;
+    }
+    double secs = (double)(now_ns() - t0) / 1e9;
+    std::sort(lat.begin(), lat.end());
+
+    printf("%zu connections in %.3f s: %.0f conn/s, %llu errors\n",
+        lat.size(), secs, (double)lat.size() / secs, (unsigned long long)errors);
+    printf("connect to reply: p50 %.1f us, p99 %.1f us, p999 %.1f us\n",
+        percentile(lat, 0.50) / 1e3, percentile(lat, 0.99) / 1e3,
+        percentile(lat, 0.999) / 1e3);
+    return errors ? 1 : 0;
+}
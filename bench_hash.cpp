@@ -0,0 +1,304 @@
+// keyspace hashing microbenchmark. first str_hash() against the FNV
+// loop it replaced, over key lengths from 8 B to 1 KB, and how keys
+// crafted to cancel the mixing constants spread. then the chained
+// HashMap, the SwissMap called the way it used to be (an out-of-line
+// search and a comparator by function pointer) and the IntrusiveMap at
+// each key count given on the command line: ns/op for inserts, hits,
+// misses and erases, the 99.9th percentile and the slowest single insert
+// (the resize pauses), and the bytes the tables themselves take.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "common.h"
+#include "hashtable.h"
+#include "swisstable.h"
+
+
+struct Node {
+    HashNode node;      // for HashMap
+    HashLink link;      // for SwissMap
+    char key[16];
+};
+
+struct NodeKey {
+    std::string_view operator()(const Node &n) const {
+        return std::string_view(n.key, sizeof(n.key));
+    }
+};
+
+static bool node_eq(HashNode *lhs, HashNode *rhs) {
+    Node *l = container_of(lhs, Node, node);
+    Node *r = container_of(rhs, Node, node);
+    return 0 == memcmp(l->key, r->key, sizeof(l->key));
+}
+
+typedef IntrusiveMap<Node, offsetof(Node, link), NodeKey> SwissNodes;
+
+// both tables used the way the server does: the key is hashed on
+// every call. HashMap needs a node built around it.
+static void map_insert(HashMap &m, Node *n) {
+    n->node.hashcode = str_hash((const uint8_t *)n->key, sizeof(n->key));
+    m.insert(&n->node);
+}
+
+static bool map_find(HashMap &m, const Node &n) {
+    Node key;
+    memcpy(key.key, n.key, sizeof(key.key));
+    key.node.hashcode = str_hash((const uint8_t *)key.key, sizeof(key.key));
+    return m.search(&key.node, &node_eq) != NULL;
+}
+
+static void map_erase(HashMap &m, const Node &n) {
+    Node key;
+    memcpy(key.key, n.key, sizeof(key.key));
+    key.node.hashcode = str_hash((const uint8_t *)key.key, sizeof(key.key));
+    m.erase(&key.node, &node_eq);
+}
+
+// the SwissMap API before IntrusiveMap: the search is compiled once,
+// apart from its callers, and every candidate goes through `eq`
+static bool link_eq(HashLink *lhs, HashLink *rhs) {
+    Node *l = container_of(lhs, Node, link);
+    Node *r = container_of(rhs, Node, link);
+    return 0 == memcmp(l->key, r->key, sizeof(l->key));
+}
+
+__attribute__((noinline))
+static HashLink *fp_search(SwissMap &m, HashLink *key, bool (*eq)(HashLink *, HashLink *)) {
+    return m.search(key->hashcode, [key, eq](HashLink *h) { return eq(h, key); });
+}
+
+__attribute__((noinline))
+static HashLink *fp_erase(SwissMap &m, HashLink *key, bool (*eq)(HashLink *, HashLink *)) {
+    return m.erase(key->hashcode, [key, eq](HashLink *h) { return eq(h, key); });
+}
+
+static void map_insert(SwissMap &m, Node *n) {
+    n->link.hashcode = str_hash((const uint8_t *)n->key, sizeof(n->key));
+    m.insert(&n->link);
+}
+
+static bool map_find(SwissMap &m, const Node &n) {
+    Node key;
+    memcpy(key.key, n.key, sizeof(key.key));
+    key.link.hashcode = str_hash((const uint8_t *)key.key, sizeof(key.key));
+    return fp_search(m, &key.link, &link_eq) != NULL;
+}
+
+static void map_erase(SwissMap &m, const Node &n) {
+    Node key;
+    memcpy(key.key, n.key, sizeof(key.key));
+    key.link.hashcode = str_hash((const uint8_t *)key.key, sizeof(key.key));
+    fp_erase(m, &key.link, &link_eq);
+}
+
+static void map_insert(SwissNodes &m, Node *n) {
+    m.insert(n);
+}
+
+static bool map_find(SwissNodes &m, const Node &n) {
+    return m.find(NodeKey()(n)) != NULL;
+}
+
+static void map_erase(SwissNodes &m, const Node &n) {
+    m.erase(NodeKey()(n));
+}
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static void node_init(Node &n, char prefix, uint64_t i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%c%015llu", prefix, (unsigned long long)i);
+    memcpy(n.key, buf, sizeof(n.key));
+    n.node.next = NULL;
+}
+
+static size_t table_bytes(const HashMap &m) {
+    return (m.hashTable1.table ? m.hashTable1.bitmask + 1 : 0) * sizeof(HashNode *)
+        + (m.hashTable2.table ? m.hashTable2.bitmask + 1 : 0) * sizeof(HashNode *);
+}
+
+static size_t table_bytes(const SwissMap &m) {
+    return (m.newer.capacity() + m.older.capacity()) * (1 + sizeof(HashLink *));
+}
+
+static size_t table_bytes(const SwissNodes &m) {
+    return table_bytes(m.map);
+}
+
+// keeps the lookups from being optimized away
+static volatile size_t g_sink;
+
+// the previous str_hash, for reference
+static uint64_t fnv_hash(const uint8_t *data, size_t len) {
+    uint32_t h = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        h = (h + data[i]) * 0x01000193;
+    }
+    return h;
+}
+
+static void run_hash() {
+    const size_t k_bytes = 256 << 20;   // hashed per length and function
+    std::vector<uint8_t> buf(64 * 1024 + 1024);
+    for (size_t i = 0; i < buf.size(); ++i) {
+        buf[i] = (uint8_t)rand();
+    }
+    printf("%-8s %8s %10s %10s\n", "hash", "len", "ns/hash", "GB/s");
+    for (size_t len = 8; len <= 1024; len *= 2) {
+        uint64_t (*funcs[])(const uint8_t *, size_t) = {&fnv_hash, &str_hash};
+        const char *names[] = {"fnv", "str_hash"};
+        for (size_t f = 0; f < 2; ++f) {
+            size_t n = k_bytes / len;
+            uint64_t acc = 0;
+            uint64_t t0 = now_ns();
+            for (size_t i = 0; i < n; ++i) {
+                // odd offsets, so most loads are unaligned
+                acc += funcs[f](&buf[(i * 61) & 0xFFFF], len);
+            }
+            uint64_t dt = now_ns() - t0;
+            g_sink = acc;
+            printf("%-8s %8zu %10.2f %10.2f\n", names[f], len,
+                double(dt) / double(n), double(n * len) / double(dt));
+        }
+    }
+    printf("\n");
+}
+
+// keys whose words equal the constant str_hash() xors them with. were
+// the seed left out of that factor, the multiply would be by zero and
+// every such key would hash the same under any seed, a flood that needs
+// no knowledge of the seed. they must spread like any other keys.
+static void run_flood() {
+    const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    const size_t k_keys = 100000;
+    const uint64_t k_buckets = 4096;
+    printf("%-8s %8s %10s %10s %10s\n", "crafted", "len", "keys", "hashes", "buckets");
+    for (size_t len : {16, 24}) {
+        std::vector<uint64_t> hashes(k_keys);
+        for (size_t i = 0; i < k_keys; ++i) {
+            uint8_t key[24];
+            if (len == 16) {
+                // the short-key path takes bytes 0-4 and 8-12 as one word
+                uint32_t hi = (uint32_t)(s1 >> 32), lo = (uint32_t)s1;
+                memcpy(&key[0], &hi, 4);
+                memcpy(&key[4], &i, 4);
+                memcpy(&key[8], &lo, 4);
+                memcpy(&key[12], (const char *)&i + 4, 4);
+            } else {
+                // the 16-byte block loop, then the last 16 bytes
+                memcpy(&key[0], &s1, 8);
+                memcpy(&key[8], &s1, 8);
+                memcpy(&key[16], &i, 8);
+            }
+            hashes[i] = str_hash(key, len);
+        }
+        std::vector<bool> used(k_buckets);
+        size_t nbuckets = 0;
+        for (uint64_t h : hashes) {
+            nbuckets += !used[h % k_buckets];
+            used[h % k_buckets] = true;
+        }
+        std::sort(hashes.begin(), hashes.end());
+        size_t distinct = std::unique(hashes.begin(), hashes.end()) - hashes.begin();
+        printf("%-8s %8zu %10zu %10zu %5zu/%-4zu\n", "str_hash", len, k_keys,
+            distinct, nbuckets, (size_t)k_buckets);
+    }
+    printf("\n");
+}
+
+template <class Map>
+static void run(const char *name, std::vector<Node> &keys,
+    std::vector<Node> &misses, const std::vector<uint32_t> &order)
+{
+    size_t n = keys.size();
+    Map m;
+
+    std::vector<uint32_t> lat(n);
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t s = now_ns();
+        map_insert(m, &keys[i]);
+        lat[i] = (uint32_t)std::min<uint64_t>(now_ns() - s, UINT32_MAX);
+    }
+    double ins = double(now_ns() - t0) / double(n);
+    std::sort(lat.begin(), lat.end());
+    uint64_t p999 = lat[n - 1 - n / 1000];
+    uint64_t worst = lat[n - 1];
+    size_t bytes = table_bytes(m);
+
+    size_t found = 0;
+    t0 = now_ns();
+    for (uint32_t i : order) {
+        found += map_find(m, keys[i]);
+    }
+    double hit = double(now_ns() - t0) / double(n);
+
+    t0 = now_ns();
+    for (uint32_t i : order) {
+        found += map_find(m, misses[i]);
+    }
+    double miss = double(now_ns() - t0) / double(n);
+    g_sink = found;
+    if (found != n) {
+        fprintf(stderr, "%s: found %zu of %zu\n", name, found, n);
+        exit(1);
+    }
+
+    t0 = now_ns();
+    for (uint32_t i : order) {
+        map_erase(m, keys[i]);
+    }
+    double del = double(now_ns() - t0) / double(n);
+
+    printf("%-8s %11zu %8.1f %8.1f %8.1f %8.1f %8.1f %10.1f %8.1f\n",
+        name, n, ins, hit, miss, del, double(p999) / 1e3, double(worst) / 1e3,
+        double(bytes) / double(n));
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        char *end = NULL;
+        unsigned long long v = strtoull(argv[i], &end, 10);
+        if (*end || v == 0 || v > UINT32_MAX) {
+            fprintf(stderr, "usage: %s [KEYS...]   (1000000 10000000)\n", argv[0]);
+            return 1;
+        }
+        sizes.push_back((size_t)v);
+    }
+    if (sizes.empty()) {
+        sizes = {1000000, 10000000};
+    }
+
+    run_hash();
+    run_flood();
+    printf("%-8s %11s %8s %8s %8s %8s %8s %10s %8s\n", "table", "keys",
+        "insert", "hit", "miss", "erase", "p999_us", "max_us", "B/key");
+    for (size_t n : sizes) {
+        std::vector<Node> keys(n), misses(n);
+        std::vector<uint32_t> order(n);
+        for (size_t i = 0; i < n; ++i) {
+            node_init(keys[i], 'k', i);
+            node_init(misses[i], 'm', i);
+            order[i] = (uint32_t)i;
+        }
+        // random order, so lookups miss the cache like real traffic
+        srand(1);
+        for (size_t i = n - 1; i > 0; --i) {
+            std::swap(order[i], order[(size_t)rand() % (i + 1)]);
+        }
+        run<HashMap>("chained", keys, misses, order);
+        run<SwissMap>("swiss_fp", keys, misses, order);
+        run<SwissNodes>("swiss", keys, misses, order);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+// small-object allocation microbenchmark, malloc against the slabs at
+// each object count given on the command line. sizes are those of the
+// keyspace entries and zset nodes, 48 to 96 bytes. phases, in ns/op:
+//   fill    allocate them all
+//   churn   free a random one and allocate another, as many times
+//   remote  another thread frees half, then they are allocated again
+//   free    free them all
+// and the RSS growth after fill, after churn and once the remote frees
+// are reused. each allocator runs in its own process, so the RSS of
+// one does not carry over to the other.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <vector>
+#include "slab.h"
+
+
+struct Block {
+    void *ptr;
+    uint32_t size;
+};
+
+struct Allocator {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr, size_t size);
+};
+
+static void *malloc_alloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+static void malloc_free(void *ptr, size_t size) {
+    (void)size;
+    free(ptr);
+}
+
+static const Allocator g_allocs[] = {
+    {"malloc", &malloc_alloc, &malloc_free},
+    {"slab", &slab_alloc, &slab_free},
+};
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t rss_kb() {
+    FILE *f = fopen("/proc/self/statm", "r");
+    unsigned long size = 0, rss = 0;
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &rss) != 2) {
+            rss = 0;
+        }
+        fclose(f);
+    }
+    return rss * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static uint64_t g_rng = 1;
+
+static uint32_t rng_next() {
+    // xorshift64*
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return (uint32_t)((g_rng * 0x2545F4914F6CDD1Dull) >> 32);
+}
+
+static uint32_t rand_size() {
+    return 48 + rng_next() % 49;
+}
+
+// touch the block like an object being initialized
+static void *block_alloc(const Allocator &a, Block &b) {
+    b.size = rand_size();
+    b.ptr = a.alloc(b.size);
+    memset(b.ptr, 0, 16);
+    return b.ptr;
+}
+
+struct RemoteArgs {
+    const Allocator *a;
+    std::vector<Block> *blocks;
+};
+
+// frees every other block, like a big key deleted on the thread pool
+static void *remote_main(void *arg) {
+    RemoteArgs *args = (RemoteArgs *)arg;
+    std::vector<Block> &blocks = *args->blocks;
+    for (size_t i = 0; i < blocks.size(); i += 2) {
+        args->a->free(blocks[i].ptr, blocks[i].size);
+    }
+    return NULL;
+}
+
+static void run(const Allocator &a, size_t n) {
+    std::vector<Block> blocks(n);
+    g_rng = 1;
+    size_t rss0 = rss_kb();
+
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        block_alloc(a, blocks[i]);
+    }
+    double fill = double(now_ns() - t0) / double(n);
+    size_t rss_fill = rss_kb() - rss0;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        Block &b = blocks[rng_next() % n];
+        a.free(b.ptr, b.size);
+        block_alloc(a, b);
+    }
+    double churn = double(now_ns() - t0) / double(n);
+    size_t rss_churn = rss_kb() - rss0;
+
+    t0 = now_ns();
+    RemoteArgs args = {&a, &blocks};
+    pthread_t th;
+    if (pthread_create(&th, NULL, &remote_main, &args)) {
+        perror("pthread_create");
+        exit(1);
+    }
+    pthread_join(th, NULL);
+    for (size_t i = 0; i < n; i += 2) {
+        block_alloc(a, blocks[i]);
+    }
+    double remote = double(now_ns() - t0) / double(n);
+    size_t rss_remote = rss_kb() - rss0;
+
+    t0 = now_ns();
+    for (Block &b : blocks) {
+        a.free(b.ptr, b.size);
+    }
+    double del = double(now_ns() - t0) / double(n);
+
+    printf("%-8s %11zu %8.1f %8.1f %8.1f %8.1f %10.1f %10.1f %10.1f\n",
+        a.name, n, fill, churn, remote, del,
+        double(rss_fill) * 1024 / double(n), double(rss_churn) * 1024 / double(n),
+        double(rss_remote) * 1024 / double(n));
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        char *end = NULL;
+        unsigned long long v = strtoull(argv[i], &end, 10);
+        if (*end || v == 0 || v > UINT32_MAX) {
+            fprintf(stderr, "usage: %s [OBJECTS...]   (1000000 10000000)\n", argv[0]);
+            return 1;
+        }
+        sizes.push_back((size_t)v);
+    }
+    if (sizes.empty()) {
+        sizes = {1000000, 10000000};
+    }
+
+    printf("%-8s %11s %8s %8s %8s %8s %10s %10s %10s\n", "alloc", "objects",
+        "fill", "churn", "remote", "free", "B/fill", "B/churn", "B/remote");
+    fflush(stdout);     // or each child prints it again
+    for (size_t n : sizes) {
+        for (const Allocator &a : g_allocs) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("fork");
+                return 1;
+            }
+            if (pid == 0) {
+                run(a, n);
+                _exit(0);
+            }
+            int status = 0;
+            waitpid(pid, &status, 0);
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "%s: failed\n", a.name);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,251 @@
+// sorted set index microbenchmark, the AVL tree against the B+tree at
+// each member count given on the command line. ns/op for inserts, for
+// seeks to a random (score, name), per member of 100-long range scans
+// from there, and the same scans stepping with avl_offset(+1) as zquery
+// used to (AVL only), for jumps by a random offset (what zquery's offset
+// does), for the rank of a random member by name (ZRANK) and for
+// removes; then the heap bytes per member, index and nodes, and the
+// ns per member of loading them all in one batch (a variadic ZADD).
+// then many small sets, packed (zpack.h) against either tree, with
+// 10-long scans and lookups by name in place of the jumps.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "zset.h"
+
+
+static uint64_t now_ns() {
+    struct timespec tv = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &tv);
+    return uint64_t(tv.tv_sec) * 1000000000 + tv.tv_nsec;
+}
+
+static size_t heap_used() {
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+}
+
+static uint64_t g_rng = 1;
+
+static uint64_t rng_next() {
+    // xorshift64*
+    g_rng ^= g_rng >> 12;
+    g_rng ^= g_rng << 25;
+    g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+// keeps the scans from being optimized away
+static volatile double g_sink;
+
+static void run(ZIndex index, const char *name, const std::vector<std::string> &names,
+    const std::vector<double> &scores)
+{
+    size_t n = names.size();
+    size_t before = heap_used();
+    ZSet *zset = new ZSet(index);
+
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        zset->add(names[i], scores[i]);
+    }
+    double ins = double(now_ns() - t0) / double(n);
+    double bytes = double(heap_used() - before) / double(n);
+
+    const size_t k_ops = std::min(n, (size_t)1000000);
+    std::vector<ZIter> its(k_ops);
+    g_rng = 7;
+    t0 = now_ns();
+    for (ZIter &it : its) {
+        it = zset->seek(double(rng_next() % (n * 4)), "");
+    }
+    double seek = double(now_ns() - t0) / double(k_ops);
+
+    const size_t k_scans = k_ops / 10;
+    const int64_t k_len = 100;
+    double sum = 0;
+    t0 = now_ns();
+    for (size_t i = 0; i < k_scans; ++i) {
+        ZIter it = its[i];
+        for (int64_t j = 0; j < k_len && it.valid(); ++j) {
+            sum += it.score();
+            zset->advance(it, +1);
+        }
+    }
+    double scan = double(now_ns() - t0) / double(k_scans * k_len);
+
+    // from other seeks, so the nodes are not in the cache from the scans
+    char walk[16] = "-";
+    if (index == ZINDEX_AVL) {
+        t0 = now_ns();
+        for (size_t i = k_scans; i < 2 * k_scans; ++i) {
+            AVLNode *node = its[i].node ? &its[i].node->tree : nullptr;
+            for (int64_t j = 0; j < k_len && node; ++j) {
+                sum += container_of(node, ZNode, tree)->getScore();
+                node = avl_offset(node, +1);
+            }
+        }
+        snprintf(walk, sizeof(walk), "%.1f", double(now_ns() - t0) / double(k_scans * k_len));
+    }
+
+    t0 = now_ns();
+    for (ZIter &it : its) {
+        zset->advance(it, (int64_t)(rng_next() % n) - (int64_t)(n / 2));
+        sum += it.valid() ? it.score() : 0;
+    }
+    double jump = double(now_ns() - t0) / double(k_ops);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < k_ops; ++i) {
+        const std::string &name = names[rng_next() % n];
+        double score = 0;
+        zset->lookup(name, score);
+        sum += (double)zset->rank(zset->seek(score, name));
+    }
+    double rank = double(now_ns() - t0) / double(k_ops);
+    g_sink = sum;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < n; ++i) {
+        zset->remove(names[i]);
+    }
+    double del = double(now_ns() - t0) / double(n);
+    delete zset;
+
+    // with the sort, as the batch comes in any order
+    zset = new ZSet(index);
+    zset->setIndex(index);
+    std::vector<ZPair> pairs(n);
+    for (size_t i = 0; i < n; ++i) {
+        pairs[i] = ZPair{scores[i], names[i]};
+    }
+    t0 = now_ns();
+    zset->addNew(pairs);
+    double bulk = double(now_ns() - t0) / double(n);
+    delete zset;
+
+    printf("%-8s %11zu %8.1f %8.1f %8.1f %8s %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+        name, n, ins, seek, scan, walk, jump, rank, del, bytes, bulk);
+}
+
+// `n` members over sets of `per_set`; `index` is -1 for packed
+static void run_small(int index, const char *name, size_t per_set,
+    const std::vector<std::string> &names, const std::vector<double> &scores)
+{
+    size_t n = names.size();
+    size_t nsets = n / per_set;
+    size_t before = heap_used();
+    std::vector<ZSet *> sets(nsets);
+    for (ZSet *&zset : sets) {
+        zset = new ZSet();
+        if (index >= 0) {
+            zset->setIndex((ZIndex)index);
+        }
+    }
+
+    // set by set, as a client filling keys would
+    uint64_t t0 = now_ns();
+    for (size_t i = 0; i < nsets * per_set; ++i) {
+        sets[i / per_set]->add(names[i], scores[i]);
+    }
+    double ins = double(now_ns() - t0) / double(nsets * per_set);
+    double bytes = double(heap_used() - before) / double(nsets * per_set);
+
+    const size_t k_ops = 1000000;
+    double sum = 0;
+    g_rng = 7;
+    t0 = now_ns();
+    for (size_t i = 0; i < k_ops; ++i) {
+        ZIter it = sets[rng_next() % nsets]->seek(double(rng_next() % (per_set * 4)), "");
+        sum += it.valid() ? it.score() : 0;
+    }
+    double seek = double(now_ns() - t0) / double(k_ops);
+
+    const int64_t k_len = 10;
+    t0 = now_ns();
+    for (size_t i = 0; i < k_ops / k_len; ++i) {
+        ZSet *zset = sets[rng_next() % nsets];
+        ZIter it = zset->seek(double(rng_next() % (per_set * 4)), "");
+        for (int64_t j = 0; j < k_len && it.valid(); ++j) {
+            sum += it.score();
+            zset->advance(it, +1);
+        }
+    }
+    double scan = double(now_ns() - t0) / double(k_ops);
+
+    t0 = now_ns();
+    for (size_t i = 0; i < k_ops; ++i) {
+        size_t k = rng_next() % (nsets * per_set);
+        double score = 0;
+        sets[k / per_set]->lookup(names[k], score);
+        sum += score;
+    }
+    double look = double(now_ns() - t0) / double(k_ops);
+    g_sink = sum;
+
+    t0 = now_ns();
+    for (size_t i = 0; i < nsets * per_set; ++i) {
+        sets[i / per_set]->remove(names[i]);
+    }
+    double del = double(now_ns() - t0) / double(nsets * per_set);
+    for (ZSet *zset : sets) {
+        delete zset;
+    }
+
+    printf("%-8s %11zu %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+        name, per_set, ins, seek, scan, look, del, bytes);
+}
+
+int main(int argc, char **argv) {
+    std::vector<size_t> sizes;
+    for (int i = 1; i < argc; ++i) {
+        char *end = NULL;
+        unsigned long long v = strtoull(argv[i], &end, 10);
+        if (*end || v == 0 || v > UINT32_MAX) {
+            fprintf(stderr, "usage: %s [MEMBERS...]   (10000 100000 1000000)\n", argv[0]);
+            return 1;
+        }
+        sizes.push_back((size_t)v);
+    }
+    if (sizes.empty()) {
+        sizes = {10000, 100000, 1000000};
+    }
+
+    printf("%-8s %11s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "index", "members",
+        "insert", "seek", "scan", "offset", "jump", "rank", "remove", "B/member", "bulk");
+    for (size_t n : sizes) {
+        std::vector<std::string> names(n);
+        std::vector<double> scores(n);
+        g_rng = 1;
+        for (size_t i = 0; i < n; ++i) {
+            names[i] = "m" + std::to_string(i);
+            // some equal scores, so names get compared too
+            scores[i] = double(rng_next() % (n * 4));
+        }
+        run(ZINDEX_AVL, "avl", names, scores);
+        run(ZINDEX_BTREE, "btree", names, scores);
+    }
+
+    // 1M members in all, the names unique across sets
+    const size_t k_small_total = 1000000;
+    printf("\n%-8s %11s %8s %8s %8s %8s %8s %8s\n", "encoding", "per set",
+        "insert", "seek", "scan", "lookup", "remove", "B/member");
+    for (size_t per_set : {8, 32, 128}) {
+        std::vector<std::string> names(k_small_total);
+        std::vector<double> scores(k_small_total);
+        g_rng = 1;
+        for (size_t i = 0; i < k_small_total; ++i) {
+            names[i] = "m" + std::to_string(i);
+            scores[i] = double(rng_next() % (per_set * 4));
+        }
+        run_small(-1, "packed", per_set, names, scores);
+        run_small(ZINDEX_AVL, "avl", per_set, names, scores);
+        run_small(ZINDEX_BTREE, "btree", per_set, names, scores);
+    }
+    return 0;
+}
@@ -0,0 +1,425 @@
+#include <assert.h>
+#include <string.h>
+#include <vector>
+#include "btree.h"
+#include "zset.h"
+
+
+// a child below this many entries is merged with or refilled from a
+// sibling. lower than half full, so an insert and a delete at the same
+// spot don't split and merge every time.
+const uint32_t k_bleaf_min = k_bleaf_cap / 4;
+const uint32_t k_binner_min = k_binner_cap / 4;
+
+static bool key_less(double lscore, std::string_view lname, double rscore, std::string_view rname) {
+    if (lscore != rscore) {
+        return lscore < rscore;
+    }
+    return lname < rname;
+}
+
+// the first slot whose item is >= (score, name)
+static uint32_t leaf_lower(const BLeaf *leaf, double score, std::string_view name) {
+    uint32_t lo = 0;
+    uint32_t hi = leaf->n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (key_less(leaf->scores[mid], leaf->items[mid]->getName(), score, name)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// the child where (score, name) is or would go: the last one whose
+// first key is <= it, or the first child
+static uint32_t inner_child(const BInner *in, double score, std::string_view name) {
+    uint32_t lo = 0;
+    uint32_t hi = in->n;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (!key_less(score, name, in->scores[mid], in->keys[mid]->getName())) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo ? lo - 1 : 0;
+}
+
+static uint64_t node_count(const BNode *node) {
+    if (node->leaf) {
+        return node->n;
+    }
+    const BInner *in = (const BInner *)node;
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < in->n; ++i) {
+        total += in->counts[i];
+    }
+    return total;
+}
+
+// keys[i] from the first item under child[i]
+static void set_key(BInner *in, uint32_t i) {
+    const BNode *child = in->child[i];
+    assert(child->n > 0);
+    if (child->leaf) {
+        in->scores[i] = ((const BLeaf *)child)->scores[0];
+        in->keys[i] = ((const BLeaf *)child)->items[0];
+    } else {
+        in->scores[i] = ((const BInner *)child)->scores[0];
+        in->keys[i] = ((const BInner *)child)->keys[0];
+    }
+}
+
+static void free_node(BNode *node) {
+    if (node->leaf) {
+        delete (BLeaf *)node;
+        return;
+    }
+    BInner *in = (BInner *)node;
+    for (uint32_t i = 0; i < in->n; ++i) {
+        free_node(in->child[i]);
+    }
+    delete in;
+}
+
+// `k` entries from src at `spos` to dst at `dpos`, they may overlap.
+// the counts are the callers'.
+static void copy_slots(BLeaf *dst, uint32_t dpos, const BLeaf *src, uint32_t spos, uint32_t k) {
+    memmove(&dst->scores[dpos], &src->scores[spos], k * sizeof(double));
+    memmove(&dst->items[dpos], &src->items[spos], k * sizeof(ZNode *));
+}
+
+static void copy_slots(BInner *dst, uint32_t dpos, const BInner *src, uint32_t spos, uint32_t k) {
+    memmove(&dst->counts[dpos], &src->counts[spos], k * sizeof(uint32_t));
+    memmove(&dst->scores[dpos], &src->scores[spos], k * sizeof(double));
+    memmove(&dst->keys[dpos], &src->keys[spos], k * sizeof(ZNode *));
+    memmove(&dst->child[dpos], &src->child[spos], k * sizeof(BNode *));
+}
+
+// the upper half of `node` to a new right sibling
+template <class T>
+static T *split_node(T *node) {
+    T *right = new T();
+    right->leaf = node->leaf;
+    uint32_t half = node->n / 2;
+    copy_slots(right, 0, node, half, node->n - half);
+    right->n = (uint16_t)(node->n - half);
+    node->n = (uint16_t)half;
+    return right;
+}
+
+static void remove_slot(BInner *in, uint32_t i) {
+    copy_slots(in, i, in, i + 1, in->n - i - 1);
+    in->n--;
+}
+
+// all of `b` to the end of `a`
+template <class T>
+static void merge_nodes(T *a, T *b) {
+    copy_slots(a, a->n, b, 0, b->n);
+    a->n = (uint16_t)(a->n + b->n);
+    b->n = 0;
+}
+
+// move entries between neighbours `a` and `b` until `a` has `want`
+template <class T>
+static void even_out(T *a, T *b, uint32_t want) {
+    if (a->n < want) {
+        uint32_t k = want - a->n;
+        copy_slots(a, a->n, b, 0, k);
+        copy_slots(b, 0, b, k, b->n - k);
+        a->n = (uint16_t)(a->n + k);
+        b->n = (uint16_t)(b->n - k);
+    } else {
+        uint32_t k = a->n - want;
+        copy_slots(b, k, b, 0, b->n);
+        copy_slots(b, 0, a, want, k);
+        a->n = (uint16_t)(a->n - k);
+        b->n = (uint16_t)(b->n + k);
+    }
+}
+
+BTree::~BTree() {
+    clear();
+}
+
+void BTree::clear() {
+    if (root) {
+        free_node(root);
+    }
+    root = nullptr;
+    count = 0;
+}
+
+void BTree::build(ZNode *const *items, size_t n) {
+    assert(!root);
+    if (n == 0) {
+        return;
+    }
+    // as few leaves as will do, the items shared out evenly so none is
+    // below the minimum
+    std::vector<BNode *> level((n + k_bleaf_cap - 1) / k_bleaf_cap);
+    BLeaf *prev = nullptr;
+    size_t done = 0;
+    for (size_t i = 0; i < level.size(); ++i) {
+        size_t k = (n - done) / (level.size() - i);
+        BLeaf *leaf = new BLeaf();
+        leaf->leaf = true;
+        for (size_t j = 0; j < k; ++j) {
+            leaf->scores[j] = items[done + j]->getScore();
+            leaf->items[j] = items[done + j];
+        }
+        leaf->n = (uint16_t)k;
+        leaf->prev = prev;
+        if (prev) {
+            prev->next = leaf;
+        }
+        prev = leaf;
+        level[i] = leaf;
+        done += k;
+    }
+    // then the inner levels the same way, up to a single root
+    while (level.size() > 1) {
+        std::vector<BNode *> up((level.size() + k_binner_cap - 1) / k_binner_cap);
+        done = 0;
+        for (size_t i = 0; i < up.size(); ++i) {
+            size_t k = (level.size() - done) / (up.size() - i);
+            BInner *in = new BInner();
+            for (size_t j = 0; j < k; ++j) {
+                in->child[j] = level[done + j];
+                in->counts[j] = (uint32_t)node_count(in->child[j]);
+                set_key(in, (uint32_t)j);
+            }
+            in->n = (uint16_t)k;
+            up[i] = in;
+            done += k;
+        }
+        level.swap(up);
+    }
+    root = level[0];
+    count = n;
+}
+
+// returns the new right sibling if `node` had to split
+BNode *BTree::insertRec(BNode *node, ZNode *item) {
+    double score = item->getScore();
+    std::string_view name = item->getName();
+    if (node->leaf) {
+        BLeaf *leaf = (BLeaf *)node;
+        uint32_t pos = leaf_lower(leaf, score, name);
+        BLeaf *right = nullptr;
+        if (leaf->n == k_bleaf_cap) {
+            right = split_node(leaf);
+            right->prev = leaf;
+            right->next = leaf->next;
+            if (right->next) {
+                right->next->prev = right;
+            }
+            leaf->next = right;
+            if (pos > leaf->n) {
+                pos -= leaf->n;
+                leaf = right;
+            }
+        }
+        copy_slots(leaf, pos + 1, leaf, pos, leaf->n - pos);
+        leaf->scores[pos] = score;
+        leaf->items[pos] = item;
+        leaf->n++;
+        return right;
+    }
+
+    BInner *in = (BInner *)node;
+    uint32_t i = inner_child(in, score, name);
+    BNode *split = insertRec(in->child[i], item);
+    set_key(in, i);     // it may be the new first
+    if (!split) {
+        in->counts[i]++;
+        return nullptr;
+    }
+    in->counts[i] = (uint32_t)node_count(in->child[i]);
+    BInner *right = nullptr;
+    uint32_t pos = i + 1;
+    if (in->n == k_binner_cap) {
+        right = split_node(in);
+        if (pos > in->n) {
+            pos -= in->n;
+            in = right;
+        }
+    }
+    copy_slots(in, pos + 1, in, pos, in->n - pos);
+    in->child[pos] = split;
+    in->counts[pos] = (uint32_t)node_count(split);
+    set_key(in, pos);
+    in->n++;
+    return right;
+}
+
+void BTree::insert(ZNode *node) {
+    if (!root) {
+        root = new BLeaf();
+        root->leaf = true;
+    }
+    BNode *split = insertRec(root, node);
+    if (split) {
+        BInner *top = new BInner();
+        top->n = 2;
+        top->child[0] = root;
+        top->child[1] = split;
+        for (uint32_t i = 0; i < 2; ++i) {
+            top->counts[i] = (uint32_t)node_count(top->child[i]);
+            set_key(top, i);
+        }
+        root = top;
+    }
+    count++;
+}
+
+// child `i` of `parent` is short: merge it with a neighbour, or take
+// some of the neighbour's entries if both don't fit in one
+void BTree::rebalance(BInner *parent, uint32_t i) {
+    uint32_t l = i > 0 ? i - 1 : 0;
+    BNode *a = parent->child[l];
+    BNode *b = parent->child[l + 1];
+    uint32_t cap = a->leaf ? k_bleaf_cap : k_binner_cap;
+    if (a->n + b->n <= cap) {
+        if (a->leaf) {
+            BLeaf *la = (BLeaf *)a;
+            BLeaf *lb = (BLeaf *)b;
+            merge_nodes(la, lb);
+            la->next = lb->next;
+            if (la->next) {
+                la->next->prev = la;
+            }
+        } else {
+            merge_nodes((BInner *)a, (BInner *)b);
+        }
+        free_node(b);
+        parent->counts[l] += parent->counts[l + 1];
+        remove_slot(parent, l + 1);
+        set_key(parent, l);
+        return;
+    }
+    uint32_t want = (a->n + b->n) / 2;
+    if (a->leaf) {
+        even_out((BLeaf *)a, (BLeaf *)b, want);
+    } else {
+        even_out((BInner *)a, (BInner *)b, want);
+    }
+    parent->counts[l] = (uint32_t)node_count(a);
+    parent->counts[l + 1] = (uint32_t)node_count(b);
+    set_key(parent, l);
+    set_key(parent, l + 1);
+}
+
+void BTree::eraseRec(BNode *node, ZNode *item) {
+    double score = item->getScore();
+    std::string_view name = item->getName();
+    if (node->leaf) {
+        BLeaf *leaf = (BLeaf *)node;
+        uint32_t pos = leaf_lower(leaf, score, name);
+        assert(pos < leaf->n && leaf->items[pos] == item);
+        copy_slots(leaf, pos, leaf, pos + 1, leaf->n - pos - 1);
+        leaf->n--;
+        return;
+    }
+
+    BInner *in = (BInner *)node;
+    uint32_t i = inner_child(in, score, name);
+    BNode *child = in->child[i];
+    eraseRec(child, item);
+    in->counts[i]--;
+    if (child->n < (child->leaf ? k_bleaf_min : k_binner_min)) {
+        rebalance(in, i);
+    } else {
+        set_key(in, i);     // it may have been the first
+    }
+}
+
+void BTree::erase(ZNode *node) {
+    assert(root);
+    eraseRec(root, node);
+    count--;
+    if (!root->leaf && root->n == 1) {
+        BInner *top = (BInner *)root;
+        root = top->child[0];
+        delete top;
+    } else if (root->leaf && root->n == 0) {
+        delete (BLeaf *)root;
+        root = nullptr;
+    }
+}
+
+BPos BTree::lowerBound(double score, std::string_view name) const {
+    BPos pos;
+    BNode *node = root;
+    if (!node) {
+        return pos;
+    }
+    while (!node->leaf) {
+        BInner *in = (BInner *)node;
+        uint32_t i = inner_child(in, score, name);
+        for (uint32_t j = 0; j < i; ++j) {
+            pos.rank += in->counts[j];
+        }
+        node = in->child[i];
+    }
+    BLeaf *leaf = (BLeaf *)node;
+    pos.slot = leaf_lower(leaf, score, name);
+    pos.rank += pos.slot;
+    pos.leaf = leaf;
+    if (pos.slot == leaf->n) {
+        // the first item of the next leaf, if any
+        pos.leaf = leaf->next;
+        pos.slot = 0;
+    }
+    return pos;
+}
+
+BPos BTree::select(uint64_t rank) const {
+    BPos pos;
+    if (rank >= count) {
+        return pos;
+    }
+    pos.rank = rank;
+    BNode *node = root;
+    while (!node->leaf) {
+        BInner *in = (BInner *)node;
+        uint32_t i = 0;
+        while (rank >= in->counts[i]) {
+            rank -= in->counts[i];
+            i++;
+        }
+        node = in->child[i];
+    }
+    pos.leaf = (BLeaf *)node;
+    pos.slot = (uint32_t)rank;
+    return pos;
+}
+
+void BTree::advance(BPos &pos, int64_t offset) const {
+    if (!pos.leaf) {
+        return;
+    }
+    int64_t slot = (int64_t)pos.slot + offset;
+    int64_t rank = (int64_t)pos.rank + offset;
+    if (slot >= 0 && slot < pos.leaf->n) {
+        pos.slot = (uint32_t)slot;
+        pos.rank = (uint64_t)rank;
+    } else if (rank < 0 || rank >= (int64_t)count) {
+        pos = BPos();
+    } else if (offset == 1) {
+        pos.leaf = pos.leaf->next;
+        pos.slot = 0;
+        pos.rank = (uint64_t)rank;
+    } else if (offset == -1) {
+        pos.leaf = pos.leaf->prev;
+        pos.slot = pos.leaf->n - 1u;
+        pos.rank = (uint64_t)rank;
+    } else {
+        pos = select((uint64_t)rank);
+    }
+}
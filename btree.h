@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+
+class ZNode;
+
+// an order-statistic B+tree over zset nodes, ordered by (score, name).
+// leaves hold the node pointers with their scores alongside, so a scan
+// reads arrays rather than chasing a pointer per member, and names are
+// only looked at on equal scores. inner nodes keep the first key and the
+// item count of each child, which gives rank and select in O(log n).
+const uint32_t k_bleaf_cap = 32;
+const uint32_t k_binner_cap = 32;
+
+struct BNode {
+    uint16_t n = 0;
+    bool leaf = false;
+};
+
+struct BLeaf : BNode {
+    BLeaf *prev = nullptr;
+    BLeaf *next = nullptr;
+    double scores[k_bleaf_cap];
+    ZNode *items[k_bleaf_cap];
+};
+
+struct BInner : BNode {
+    uint32_t counts[k_binner_cap];  // items under each child
+    double scores[k_binner_cap];    // of keys[]
+    ZNode *keys[k_binner_cap];      // the first item under each child
+    BNode *child[k_binner_cap];
+};
+
+// a position, valid until the tree is changed. `leaf` is NULL past
+// either end.
+struct BPos {
+    BLeaf *leaf = nullptr;
+    uint32_t slot = 0;
+    uint64_t rank = 0;
+};
+
+class BTree {
+public:
+    BTree() = default;
+    ~BTree();
+
+    BTree(const BTree &) = delete;
+    BTree &operator=(const BTree &) = delete;
+
+    // ordered by node->score and node->name, which must not change while
+    // the node is in the tree
+    void insert(ZNode *node);
+    void erase(ZNode *node);
+    // `n` items in order into an empty tree, O(n) with the leaves
+    // evenly filled
+    void build(ZNode *const *items, size_t n);
+    // the tree nodes only, the items are left alone
+    void clear();
+    size_t size() const { return count; }
+
+    // the first item >= (score, name)
+    BPos lowerBound(double score, std::string_view name) const;
+    // the item with `rank` items before it
+    BPos select(uint64_t rank) const;
+    void advance(BPos &pos, int64_t offset) const;
+    static ZNode *at(const BPos &pos) {
+        return pos.leaf ? pos.leaf->items[pos.slot] : nullptr;
+    }
+
+private:
+    BNode *insertRec(BNode *node, ZNode *item);
+    void eraseRec(BNode *node, ZNode *item);
+    void rebalance(BInner *parent, uint32_t i);
+
+    BNode *root = nullptr;
+    size_t count = 0;
+};
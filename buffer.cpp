@@ -0,0 +1,243 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+
+// segments kept per thread for reuse, the rest go back to malloc
+const size_t k_seg_pool_max = 1024;
+
+static thread_local struct {
+    Segment *free = nullptr;
+    size_t nfree = 0;
+} t_segs;
+
+Segment *seg_alloc() {
+    Segment *seg = t_segs.free;
+    if (seg) {
+        t_segs.free = seg->next;
+        t_segs.nfree--;
+    } else {
+        seg = (Segment *)malloc(sizeof(Segment));
+        if (!seg) {
+            abort();
+        }
+    }
+    seg->next = nullptr;
+    seg->start = seg->end = 0;
+    return seg;
+}
+
+void seg_free(Segment *seg) {
+    if (t_segs.nfree >= k_seg_pool_max) {
+        free(seg);
+        return;
+    }
+    seg->next = t_segs.free;
+    t_segs.free = seg;
+    t_segs.nfree++;
+}
+
+void chain_append(ChainBuf *buf, const void *data, size_t len) {
+    const uint8_t *src = (const uint8_t *)data;
+    buf->size += len;
+    while (len > 0) {
+        if (!buf->tail || buf->tail->end == k_seg_size) {
+            Segment *seg = seg_alloc();
+            if (buf->tail) {
+                buf->tail->next = seg;
+            } else {
+                buf->head = seg;
+            }
+            buf->tail = seg;
+        }
+        Segment *seg = buf->tail;
+        size_t n = k_seg_size - seg->end;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&seg->data[seg->end], src, n);
+        seg->end += (uint32_t)n;
+        src += n;
+        len -= n;
+    }
+}
+
+uint8_t *chain_reserve(ChainBuf *buf, size_t n) {
+    assert(n <= k_seg_size);
+    if (!buf->tail || k_seg_size - buf->tail->end < n) {
+        Segment *seg = seg_alloc();
+        if (buf->tail) {
+            buf->tail->next = seg;
+        } else {
+            buf->head = seg;
+        }
+        buf->tail = seg;
+    }
+    uint8_t *p = &buf->tail->data[buf->tail->end];
+    buf->tail->end += (uint32_t)n;
+    buf->size += n;
+    return p;
+}
+
+void chain_splice(ChainBuf *dst, ChainBuf *src) {
+    if (!src->head) {
+        return;
+    }
+    if (dst->tail) {
+        dst->tail->next = src->head;
+    } else {
+        dst->head = src->head;
+    }
+    dst->tail = src->tail;
+    dst->size += src->size;
+    src->head = src->tail = nullptr;
+    src->size = 0;
+}
+
+ChainMark chain_mark(ChainBuf *buf) {
+    ChainMark mark;
+    mark.seg = buf->tail;
+    mark.end = buf->tail ? buf->tail->end : 0;
+    mark.size = buf->size;
+    return mark;
+}
+
+void chain_truncate(ChainBuf *buf, const ChainMark &mark) {
+    Segment *rest = buf->head;
+    if (mark.seg) {
+        rest = mark.seg->next;
+        mark.seg->next = nullptr;
+        mark.seg->end = mark.end;
+    } else {
+        buf->head = nullptr;
+    }
+    buf->tail = mark.seg;
+    buf->size = mark.size;
+    while (rest) {
+        Segment *seg = rest;
+        rest = seg->next;
+        seg_free(seg);
+    }
+}
+
+int chain_iov(ChainBuf *buf, struct iovec *iov, int max) {
+    int n = 0;
+    for (Segment *seg = buf->head; seg && n < max; seg = seg->next) {
+        if (seg->start == seg->end) {
+            continue;
+        }
+        iov[n].iov_base = &seg->data[seg->start];
+        iov[n].iov_len = seg->end - seg->start;
+        n++;
+    }
+    return n;
+}
+
+void chain_consume(ChainBuf *buf, size_t n) {
+    assert(n <= buf->size);
+    buf->size -= n;
+    while (n > 0) {
+        Segment *seg = buf->head;
+        size_t avail = seg->end - seg->start;
+        if (n < avail) {
+            seg->start += (uint32_t)n;
+            return;
+        }
+        n -= avail;
+        buf->head = seg->next;
+        if (!buf->head) {
+            buf->tail = nullptr;
+        }
+        seg_free(seg);
+    }
+    if (buf->size == 0) {
+        // drop a drained segment too, the next reply may never come
+        chain_clear(buf);
+    }
+}
+
+void chain_clear(ChainBuf *buf) {
+    while (buf->head) {
+        Segment *seg = buf->head;
+        buf->head = seg->next;
+        seg_free(seg);
+    }
+    buf->tail = nullptr;
+    buf->size = 0;
+}
+
+static void inbuf_release(InBuf *buf) {
+    if (buf->seg) {
+        seg_free(buf->seg);
+        buf->seg = nullptr;
+    } else if (buf->data != buf->small) {
+        free(buf->data);
+    }
+}
+
+void inbuf_reserve(InBuf *buf, size_t n) {
+    // always read into at least a segment, never into the inline bytes
+    if (buf->data != buf->small) {
+        if (inbuf_room(buf) >= n) {
+            return;
+        }
+        if (buf->cap - buf->size >= n) {
+            // compact, the only place unserved bytes are moved
+            memmove(buf->data, inbuf_head(buf), buf->size);
+            buf->start = 0;
+            return;
+        }
+    }
+    size_t need = buf->size + n;
+    size_t cap = k_seg_size;
+    while (cap < need) {
+        cap *= 2;
+    }
+
+    Segment *seg = nullptr;
+    uint8_t *data = nullptr;
+    if (cap == k_seg_size) {
+        seg = seg_alloc();
+        data = seg->data;
+    } else {
+        data = (uint8_t *)malloc(cap);
+        if (!data) {
+            abort();
+        }
+    }
+    memcpy(data, inbuf_head(buf), buf->size);
+    inbuf_release(buf);
+    buf->data = data;
+    buf->start = 0;
+    buf->cap = cap;
+    buf->seg = seg;
+}
+
+void inbuf_consume(InBuf *buf, size_t n) {
+    assert(n <= buf->size);
+    buf->start += n;
+    buf->size -= n;
+    if (buf->size == 0) {
+        buf->start = 0;
+    }
+}
+
+void inbuf_shrink(InBuf *buf) {
+    if (buf->data == buf->small || buf->size > k_inbuf_inline) {
+        return;
+    }
+    memcpy(buf->small, inbuf_head(buf), buf->size);
+    inbuf_release(buf);
+    buf->data = buf->small;
+    buf->start = 0;
+    buf->cap = k_inbuf_inline;
+}
+
+void inbuf_free(InBuf *buf) {
+    inbuf_release(buf);
+    buf->data = buf->small;
+    buf->start = 0;
+    buf->cap = k_inbuf_inline;
+    buf->size = 0;
+}
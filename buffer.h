@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+
+// connection buffers are built from fixed-size segments recycled
+// through a per-thread free list, so an idle connection holds none.
+const size_t k_seg_size = 16 * 1024;
+
+struct Segment {
+    Segment *next = nullptr;
+    uint32_t start = 0;     // first byte not yet consumed
+    uint32_t end = 0;       // first free byte
+    uint8_t data[k_seg_size];
+};
+
+Segment *seg_alloc();
+void seg_free(Segment *seg);
+
+// output: appended at the tail, written out from the head
+struct ChainBuf {
+    Segment *head = nullptr;
+    Segment *tail = nullptr;
+    size_t size = 0;
+};
+
+void chain_append(ChainBuf *buf, const void *data, size_t len);
+// `n` contiguous bytes at the tail, to be filled in later. they stay put
+// until written out, a short tail segment is left unused for them.
+uint8_t *chain_reserve(ChainBuf *buf, size_t n);
+// move all of `src` to the tail of `dst`
+void chain_splice(ChainBuf *dst, ChainBuf *src);
+
+// the tail at some point, to drop what was appended after it. nothing
+// may be consumed in between.
+struct ChainMark {
+    Segment *seg = nullptr;
+    uint32_t end = 0;
+    size_t size = 0;
+};
+
+ChainMark chain_mark(ChainBuf *buf);
+void chain_truncate(ChainBuf *buf, const ChainMark &mark);
+// describe the unwritten bytes, returns the number of iovecs used
+int chain_iov(ChainBuf *buf, struct iovec *iov, int max);
+// drop `n` written bytes, fully consumed segments go back to the pool
+void chain_consume(ChainBuf *buf, size_t n);
+void chain_clear(ChainBuf *buf);
+
+// input: contiguous so a request can be parsed in place. the few bytes
+// left between requests stay inline; reading moves to a pooled segment,
+// or to a heap block for messages larger than one. served requests only
+// advance `start`, bytes are moved when the tail runs out of room.
+const size_t k_inbuf_inline = 128;
+
+struct InBuf {
+    uint8_t *data = small;
+    size_t start = 0;   // first unserved byte
+    size_t size = 0;    // unserved bytes
+    size_t cap = k_inbuf_inline;
+    Segment *seg = nullptr;     // set when data lives in a segment
+    uint8_t small[k_inbuf_inline];
+
+    InBuf() = default;
+    InBuf(const InBuf &) = delete;
+    InBuf &operator=(const InBuf &) = delete;
+};
+
+inline uint8_t *inbuf_head(InBuf *buf) {
+    return buf->data + buf->start;
+}
+
+inline uint8_t *inbuf_tail(InBuf *buf) {
+    return buf->data + buf->start + buf->size;
+}
+
+inline size_t inbuf_room(InBuf *buf) {
+    return buf->cap - buf->start - buf->size;
+}
+
+// make room for at least `n` more bytes at inbuf_tail()
+void inbuf_reserve(InBuf *buf, size_t n);
+void inbuf_consume(InBuf *buf, size_t n);
+// go back to the inline storage once the remainder fits
+void inbuf_shrink(InBuf *buf);
+void inbuf_free(InBuf *buf);
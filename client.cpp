@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "client.h"
+
+
+// arrays nested deeper than this are refused rather than recursed into,
+// a frame of a few MB could otherwise nest deep enough to blow the stack
+const uint32_t k_max_depth = 64;
+
+static int64_t parse(const uint8_t *data, size_t size, Reply &out, uint32_t depth) {
+    if (size < 1) {
+        return -EBADMSG;
+    }
+    out = Reply();
+    out.type = data[0];
+    switch (data[0]) {
+    case SER_NIL:
+        return 1;
+    case SER_ERR: {
+        if (size < 1 + 8) {
+            return -EBADMSG;
+        }
+        uint32_t len = 0;
+        memcpy(&out.code, &data[1], 4);
+        memcpy(&len, &data[5], 4);
+        if (size - 9 < len) {
+            return -EBADMSG;
+        }
+        out.str = std::string_view((const char *)&data[9], len);
+        return 9 + (int64_t)len;
+    }
+    case SER_STR: {
+        if (size < 1 + 4) {
+            return -EBADMSG;
+        }
+        uint32_t len = 0;
+        memcpy(&len, &data[1], 4);
+        if (size - 5 < len) {
+            return -EBADMSG;
+        }
+        out.str = std::string_view((const char *)&data[5], len);
+        return 5 + (int64_t)len;
+    }
+    case SER_INT:
+        if (size < 1 + 8) {
+            return -EBADMSG;
+        }
+        memcpy(&out.integer, &data[1], 8);
+        return 9;
+    case SER_DBL:
+        if (size < 1 + 8) {
+            return -EBADMSG;
+        }
+        memcpy(&out.dbl, &data[1], 8);
+        return 9;
+    case SER_ARR: {
+        if (size < 1 + 4 || depth == k_max_depth) {
+            return -EBADMSG;
+        }
+        memcpy(&out.count, &data[1], 4);
+        size_t pos = 5;
+        Reply elem;
+        for (uint32_t i = 0; i < out.count; ++i) {
+            int64_t rv = parse(&data[pos], size - pos, elem, depth + 1);
+            if (rv < 0) {
+                return rv;
+            }
+            pos += (size_t)rv;
+        }
+        out.elems = std::string_view((const char *)&data[5], pos - 5);
+        return (int64_t)pos;
+    }
+    default:
+        return -EBADMSG;
+    }
+}
+
+int64_t reply_parse(const uint8_t *data, size_t size, Reply &out) {
+    return parse(data, size, out, 0);
+}
+
+Reply::Iter Reply::begin() const {
+    return Iter((const uint8_t *)elems.data(), count);
+}
+
+Reply::Iter Reply::end() const {
+    return Iter(nullptr, 0);
+}
+
+Reply::Iter::Iter(const uint8_t *pos, uint32_t left) : pos(pos), left(left) {
+    decode();
+}
+
+Reply::Iter &Reply::Iter::operator++() {
+    pos += size;
+    left--;
+    decode();
+    return *this;
+}
+
+void Reply::Iter::decode() {
+    if (left == 0) {
+        return;
+    }
+    // validated as part of the enclosing reply, the bound is not needed
+    int64_t rv = reply_parse(pos, SIZE_MAX, cur);
+    size = (uint32_t)rv;
+}
+
+Connection::~Connection() {
+    close();
+}
+
+int Connection::connect(const std::string &host, uint16_t port) {
+    close();
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &res)) {
+        return -EHOSTUNREACH;
+    }
+    int err = -ECONNREFUSED;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) {
+            err = -errno;
+            continue;
+        }
+        if (::connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            err = -errno;
+            ::close(fd);
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        fd_ = fd;
+        err = 0;
+        break;
+    }
+    freeaddrinfo(res);
+    return err;
+}
+
+void Connection::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    wbuf_.clear();
+    wpos_ = 0;
+    rbuf_.clear();
+    rpos_ = rend_ = 0;
+    // nothing will answer them now
+    std::deque<ReplyCallback> cbs;
+    cbs.swap(callbacks_);
+    for (ReplyCallback &cb : cbs) {
+        if (cb) {
+            cb(nullptr, -ECONNRESET);
+        }
+    }
+}
+
+int Connection::fail(int err) {
+    close();
+    return err;
+}
+
+int Connection::submit(const std::vector<std::string_view> &cmd, ReplyCallback cb) {
+    if (fd_ < 0) {
+        return -ENOTCONN;
+    }
+    size_t len = 4;
+    for (std::string_view s : cmd) {
+        len += 4 + s.size();
+    }
+    if (len > max_msg) {
+        return -EMSGSIZE;
+    }
+    uint32_t u32 = (uint32_t)len;
+    wbuf_.append((const char *)&u32, 4);
+    u32 = (uint32_t)cmd.size();
+    wbuf_.append((const char *)&u32, 4);
+    for (std::string_view s : cmd) {
+        u32 = (uint32_t)s.size();
+        wbuf_.append((const char *)&u32, 4);
+        wbuf_.append(s.data(), s.size());
+    }
+    callbacks_.push_back(std::move(cb));
+    return 0;
+}
+
+int Connection::flush() {
+    while (wpos_ < wbuf_.size()) {
+        ssize_t rv = write(fd_, &wbuf_[wpos_], wbuf_.size() - wpos_);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        if (rv < 0) {
+            return fail(-errno);
+        }
+        wpos_ += (size_t)rv;
+    }
+    wbuf_.clear();
+    wpos_ = 0;
+    return 0;
+}
+
+// run the callbacks of the complete replies in the read buffer
+int Connection::dispatch() {
+    while (rend_ - rpos_ >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, &rbuf_[rpos_], 4);
+        if (len > max_msg) {
+            return fail(-EMSGSIZE);
+        }
+        if (rend_ - rpos_ - 4 < len) {
+            break;
+        }
+        if (callbacks_.empty()) {
+            return fail(-EPROTO);   // a reply to nothing
+        }
+        Reply reply;
+        int64_t rv = reply_parse(&rbuf_[rpos_ + 4], len, reply);
+        if (rv != (int64_t)len) {
+            return fail(-EBADMSG);
+        }
+        ReplyCallback cb = std::move(callbacks_.front());
+        callbacks_.pop_front();
+        rpos_ += 4 + (size_t)len;
+        if (cb) {
+            cb(&reply, 0);
+        }
+        if (fd_ < 0) {
+            return -ECONNRESET;     // closed by the callback
+        }
+    }
+    if (rpos_ == rend_) {
+        rpos_ = rend_ = 0;
+    }
+    return 0;
+}
+
+int Connection::process() {
+    const size_t k_read_size = 64 * 1024;
+    while (fd_ >= 0) {
+        if (rbuf_.size() - rend_ < k_read_size) {
+            // move the partial reply to the front, grow if still short
+            if (rpos_ > 0) {
+                memmove(rbuf_.data(), &rbuf_[rpos_], rend_ - rpos_);
+                rend_ -= rpos_;
+                rpos_ = 0;
+            }
+            if (rbuf_.size() - rend_ < k_read_size) {
+                rbuf_.resize(rend_ + k_read_size);
+            }
+        }
+        size_t room = rbuf_.size() - rend_;
+        ssize_t rv = read(fd_, &rbuf_[rend_], room);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv < 0 && errno == EAGAIN) {
+            return 0;
+        }
+        if (rv < 0) {
+            return fail(-errno);
+        }
+        if (rv == 0) {
+            return fail(-ECONNRESET);
+        }
+        rend_ += (size_t)rv;
+        int err = dispatch();
+        if (err < 0) {
+            return err;
+        }
+        if ((size_t)rv < room) {
+            return 0;   // drained
+        }
+    }
+    return -ENOTCONN;
+}
+
+int Connection::wait(int timeout_ms) {
+    while (fd_ >= 0 && (pending() > 0 || want_write())) {
+        int rv = flush();
+        if (rv < 0) {
+            return rv;
+        }
+        struct pollfd pfd = {fd_, POLLIN, 0};
+        if (want_write()) {
+            pfd.events |= POLLOUT;
+        }
+        rv = poll(&pfd, 1, timeout_ms);
+        if (rv < 0 && errno == EINTR) {
+            continue;
+        }
+        if (rv < 0) {
+            return fail(-errno);
+        }
+        if (rv == 0) {
+            return -ETIMEDOUT;
+        }
+        if (pfd.revents & (POLLIN | POLLERR | POLLHUP)) {
+            rv = process();
+            if (rv < 0) {
+                return rv;
+            }
+        }
+    }
+    return fd_ >= 0 ? 0 : -ENOTCONN;
+}
+
+int Connection::call(const std::vector<std::string_view> &cmd, ReplyCallback cb) {
+    int rv = submit(cmd, std::move(cb));
+    if (rv < 0) {
+        return rv;
+    }
+    return wait();
+}
+
+ConnPool::ConnPool(std::string host, uint16_t port, size_t max_conns)
+    : host_(std::move(host)), port_(port), max_conns_(max_conns) {}
+
+ConnPool::~ConnPool() {
+    for (Connection *conn : idle_) {
+        delete conn;
+    }
+}
+
+Connection *ConnPool::acquire(int *err) {
+    std::unique_lock<std::mutex> lock(mu_);
+    cv_.wait(lock, [this] { return !idle_.empty() || open_ < max_conns_; });
+    if (!idle_.empty()) {
+        Connection *conn = idle_.back();
+        idle_.pop_back();
+        return conn;
+    }
+    open_++;
+    lock.unlock();
+
+    Connection *conn = new Connection();
+    int rv = conn->connect(host_, port_);
+    if (rv < 0) {
+        delete conn;
+        lock.lock();
+        open_--;
+        cv_.notify_one();
+        if (err) {
+            *err = rv;
+        }
+        return nullptr;
+    }
+    return conn;
+}
+
+void ConnPool::release(Connection *conn) {
+    if (conn->connected()) {
+        (void)conn->wait();
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    if (conn->connected()) {
+        idle_.push_back(conn);
+    } else {
+        delete conn;
+        open_--;
+    }
+    cv_.notify_one();
+}
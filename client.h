@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "protocol.h"
+
+
+// client side of the protocol: persistent connections, pipelining and
+// a reply parser that decodes frames in place. every call returns 0 or
+// -errno, nothing is printed.
+
+// one decoded value. strings are views into the received frame and are
+// only valid inside the callback they are passed to.
+struct Reply {
+    uint8_t type = SER_NIL;
+    int32_t code = 0;           // SER_ERR
+    int64_t integer = 0;        // SER_INT
+    double dbl = 0;             // SER_DBL
+    std::string_view str;       // SER_STR, or the SER_ERR message
+    uint32_t count = 0;         // SER_ARR elements
+    std::string_view elems;     // SER_ARR, the encoded elements
+
+    class Iter;
+    Iter begin() const;
+    Iter end() const;
+};
+
+// walks the elements of a SER_ARR, decoding each one as it goes
+class Reply::Iter {
+public:
+    Iter(const uint8_t *pos, uint32_t left);
+    const Reply &operator*() const { return cur; }
+    const Reply *operator->() const { return &cur; }
+    Iter &operator++();
+    bool operator!=(const Iter &rhs) const { return left != rhs.left; }
+
+private:
+    void decode();
+
+    const uint8_t *pos;
+    uint32_t left;
+    uint32_t size = 0;  // of the current element
+    Reply cur;
+};
+
+// decode one value, returns the bytes it takes or -EBADMSG. nested
+// arrays are validated here, so iterating them later can't fail; more
+// than 64 levels of them are refused.
+int64_t reply_parse(const uint8_t *data, size_t size, Reply &out);
+
+// `reply` is NULL when the connection failed before it arrived, then
+// `err` says why
+typedef std::function<void(const Reply *reply, int err)> ReplyCallback;
+
+// one connection. requests are queued by submit(), written by flush()
+// and their replies handed to the callbacks in order by process().
+// the socket is non-blocking: either drive it from an event loop with
+// fd() and want_write(), or block in wait().
+class Connection {
+public:
+    Connection() = default;
+    ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection &operator=(const Connection &) = delete;
+
+    int connect(const std::string &host, uint16_t port);
+    void close();
+    bool connected() const { return fd_ >= 0; }
+    int fd() const { return fd_; }
+
+    int submit(const std::vector<std::string_view> &cmd, ReplyCallback cb);
+    // write as much of the queued requests as the socket takes
+    int flush();
+    bool want_write() const { return wpos_ < wbuf_.size(); }
+    // read what is there and run the callbacks of complete replies
+    int process();
+    // requests without a reply yet
+    size_t pending() const { return callbacks_.size(); }
+    // flush and process until nothing is pending. -ETIMEDOUT after
+    // `timeout_ms` without progress, < 0 waits forever.
+    int wait(int timeout_ms = -1);
+
+    // submit, then wait until this reply and any before it are in
+    int call(const std::vector<std::string_view> &cmd, ReplyCallback cb);
+
+    size_t max_msg = 64 << 20;  // the server's default --max-msg
+
+private:
+    int dispatch();
+    int fail(int err);
+
+    int fd_ = -1;
+    std::string wbuf_;
+    size_t wpos_ = 0;           // first byte not written
+    std::vector<uint8_t> rbuf_;
+    size_t rpos_ = 0;           // first byte not parsed
+    size_t rend_ = 0;           // first byte not read
+    std::deque<ReplyCallback> callbacks_;
+};
+
+// connections to one server shared by several threads. acquire() hands
+// out an idle one, opens another while under `max_conns`, or waits.
+class ConnPool {
+public:
+    ConnPool(std::string host, uint16_t port, size_t max_conns);
+    ~ConnPool();
+
+    ConnPool(const ConnPool &) = delete;
+    ConnPool &operator=(const ConnPool &) = delete;
+
+    // NULL if a new connection could not be opened, `*err` says why
+    Connection *acquire(int *err = nullptr);
+    // replies still pending are waited for first, a failed connection
+    // is closed and its slot freed
+    void release(Connection *conn);
+
+private:
+    std::string host_;
+    uint16_t port_;
+    size_t max_conns_;
+    size_t open_ = 0;
+    std::vector<Connection *> idle_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+};
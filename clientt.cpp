@@ -1,26 +1,19 @@
-#include <cassert>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <vector>
 #include <string>
-#include <stdexcept>
-#include <system_error>
+#include <string_view>
+#include <chrono>
 
-#include <unistd.h>
-#include <arpa/inet.h>
-#include <sys/socket.h>
-#include <netinet/ip.h>
-#include <errno.h>
-
-#include "common.h"
+#include "client.h"
 
 
 
 class NetworkClient {
 private:
-    static constexpr size_t k_max_msg = 4096;
+    static bool quiet;  // parse replies without printing them
 
 
 
@@ -28,250 +21,138 @@ private:
         std::cerr << message << std::endl;
     }
 
-    [[noreturn]] static void die(const std::string& message) {
-        std::error_code ec(errno, std::system_category());
-        std::cerr << "[" << ec.value() << "] " << message << std::endl;
-        std::abort();
-    }
-
-
-
-    static int32_t read_full(int fd, char* buf, size_t n) {
-        while (n > 0) {
-            ssize_t rv = read(fd, buf, n);
-            if (rv <= 0) {
-                return -1;  
-
-            }
-            assert(static_cast<size_t>(rv) <= n);
-            n -= static_cast<size_t>(rv);
-            buf += rv;
-        }
-        return 0;
-    }
-
-
-    static int32_t write_all(int fd, const char* buf, size_t n) {
-        while (n > 0) {
-            ssize_t rv = write(fd, buf, n);
-            if (rv <= 0) {
-                return -1;  
-            }
-            assert(static_cast<size_t>(rv) <= n);
-            n -= static_cast<size_t>(rv);
-            buf += rv;
-        }
-        return 0;
-    }
-
-
-
-    static int32_t send_req(int fd, const std::vector<std::string>& cmd) {
-        uint32_t len = 4;
-        for (const std::string& s : cmd) {
-            len += 4 + s.size();
-        }
-        if (len > k_max_msg) {
-            return -1;
-        }
-
-        std::vector<char> wbuf(4 + k_max_msg);
-        memcpy(&wbuf[0], &len, 4); 
-
-
-        uint32_t n = cmd.size();
-        memcpy(&wbuf[4], &n, 4);
-        size_t cur = 8;
-        for (const std::string& s : cmd) {
-            uint32_t p = static_cast<uint32_t>(s.size());
-            memcpy(&wbuf[cur], &p, 4);
-            memcpy(&wbuf[cur + 4], s.data(), s.size());
-            cur += 4 + s.size();
-        }
-        return write_all(fd, wbuf.data(), 4 + len);
-    }
-
-
-
-    static int32_t on_response(const uint8_t* data, size_t size) {
-        if (size < 1) {
-            msg("bad response");
-            return -1;
-        }
-        switch (data[0]) {
+    static void print_reply(const Reply& reply) {
+        switch (reply.type) {
         case SER_NIL:
             std::cout << "(nil)" << std::endl;
-            return 1;
+            break;
         case SER_ERR:
-            if (size < 1 + 8) {
-                msg("bad response");
-                return -1;
-            }
-            {
-                int32_t code = 0;
-                uint32_t len = 0;
-                memcpy(&code, &data[1], 4);
-                memcpy(&len, &data[1 + 4], 4);
-                if (size < 1 + 8 + len) {
-                    msg("bad response");
-                    return -1;
-                }
-                std::cout << "(err) " << code << " " 
-                          << std::string(reinterpret_cast<const char*>(&data[1 + 8]), len) 
-                          << std::endl;
-                return 1 + 8 + len;
-            }
+            std::cout << "(err) " << reply.code << " " << reply.str << std::endl;
+            break;
         case SER_STR:
-            if (size < 1 + 4) {
-                msg("bad response");
-                return -1;
-            }
-            {
-                uint32_t len = 0;
-                memcpy(&len, &data[1], 4);
-                if (size < 1 + 4 + len) {
-                    msg("bad response");
-                    return -1;
-                }
-                std::cout << "(str) " 
-                          << std::string(reinterpret_cast<const char*>(&data[1 + 4]), len) 
-                          << std::endl;
-                return 1 + 4 + len;
-            }
+            std::cout << "(str) " << reply.str << std::endl;
+            break;
         case SER_INT:
-            if (size < 1 + 8) {
-                msg("bad response");
-                return -1;
-            }
-            {
-                int64_t val = 0;
-                memcpy(&val, &data[1], 8);
-                std::cout << "(int) " << val << std::endl;
-                return 1 + 8;
-            }
+            std::cout << "(int) " << reply.integer << std::endl;
+            break;
         case SER_DBL:
-            if (size < 1 + 8) {
-                msg("bad response");
-                return -1;
-            }
-            {
-                double val = 0;
-                memcpy(&val, &data[1], 8);
-                std::cout << "(dbl) " << val << std::endl;
-                return 1 + 8;
-            }
+            std::cout << "(dbl) " << reply.dbl << std::endl;
+            break;
         case SER_ARR:
-            if (size < 1 + 4) {
-                msg("bad response");
-                return -1;
+            std::cout << "(arr) len=" << reply.count << std::endl;
+            for (const Reply& elem : reply) {
+                print_reply(elem);
             }
-            {
-                uint32_t len = 0;
-                memcpy(&len, &data[1], 4);
-                std::cout << "(arr) len=" << len << std::endl;
-                size_t arr_bytes = 1 + 4;
-                for (uint32_t i = 0; i < len; ++i) {
-                    int32_t rv = on_response(&data[arr_bytes], size - arr_bytes);
-                    if (rv < 0) {
-                        return rv;
-                    }
-                    arr_bytes += static_cast<size_t>(rv);
-                }
-                std::cout << "(arr) end" << std::endl;
-                return static_cast<int32_t>(arr_bytes);
-            }
-        default:
-            msg("bad response");
-            return -1;
+            std::cout << "(arr) end" << std::endl;
+            break;
         }
     }
 
-
-
-
-    static int32_t read_res(int fd) {
-        std::vector<char> rbuf(4 + k_max_msg + 1);
-        errno = 0;
-        int32_t err = read_full(fd, rbuf.data(), 4);
-        if (err) {
-            if (errno == 0) {
-                msg("EOF");
-            } else {
-                msg("read() error");
-            }
-            return err;
+    static void on_response(const Reply* reply, int err) {
+        if (!reply) {
+            msg(std::string("connection lost: ") + strerror(-err));
+            return;
         }
-
-        uint32_t len = 0;
-        memcpy(&len, rbuf.data(), 4);  
-        if (len > k_max_msg) {
-            msg("too long");
-            return -1;
+        if (!quiet) {
+            print_reply(*reply);
         }
+    }
 
 
 
-        err = read_full(fd, &rbuf[4], len);
-        if (err) {
-            msg("read() error");
-            return err;
+    // send the same command `count` times, either waiting for each reply
+    // (one round trip per request) or pipelined (all requests in one
+    // write, then all replies). only the last reply is printed.
+    static int32_t run_repeated(Connection& conn, const std::vector<std::string_view>& cmd,
+                                uint32_t count, bool pipeline) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; ++i) {
+            bool last = (i + 1 == count);
+            int rv = conn.submit(cmd, [last](const Reply* reply, int err) {
+                quiet = !last;
+                on_response(reply, err);
+            });
+            if (rv == 0 && !pipeline) {
+                rv = conn.wait();
+            }
+            if (rv < 0) {
+                msg(std::string("request failed: ") + strerror(-rv));
+                return -1;
+            }
         }
-
-
-
-        int32_t rv = on_response(reinterpret_cast<uint8_t*>(&rbuf[4]), len);
-        if (rv > 0 && static_cast<uint32_t>(rv) != len) {
-            msg("bad response");
-            rv = -1;
+        int rv = conn.wait();
+        if (rv < 0) {
+            msg(std::string("request failed: ") + strerror(-rv));
+            return -1;
         }
-        return rv;
+        auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cerr << count << " requests in " << usec << " us"
+                  << (pipeline ? " (pipelined)" : "") << std::endl;
+        return 0;
     }
 
 public:
 
 
     static int run(int argc, char** argv) {
-        int fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (fd < 0) {
-            die("socket()");
+        // client [-h HOST] [-P PORT] [-n COUNT] [-p] cmd args...
+        std::string host = "127.0.0.1";
+        uint16_t port = 1234;
+        uint32_t count = 1;
+        bool pipeline = false;
+        int argi = 1;
+        while (argi < argc && argv[argi][0] == '-') {
+            std::string opt = argv[argi];
+            if (opt == "-n" && argi + 1 < argc) {
+                count = static_cast<uint32_t>(std::strtoul(argv[argi + 1], nullptr, 10));
+                argi += 2;
+            } else if (opt == "-h" && argi + 1 < argc) {
+                host = argv[argi + 1];
+                argi += 2;
+            } else if (opt == "-P" && argi + 1 < argc) {
+                port = static_cast<uint16_t>(std::strtoul(argv[argi + 1], nullptr, 10));
+                argi += 2;
+            } else if (opt == "-p") {
+                pipeline = true;
+                argi++;
+            } else {
+                break;
+            }
+        }
+        if (argi >= argc || count == 0) {
+            std::cerr << "usage: " << argv[0]
+                      << " [-h HOST] [-P PORT] [-n COUNT] [-p] cmd args..." << std::endl;
+            return 1;
         }
 
-
-
-        struct SocketGuard {
-            int fd;
-            SocketGuard(int socket_fd) : fd(socket_fd) {}
-            ~SocketGuard() { close(fd); }
-        } socket_guard(fd);
-
-        sockaddr_in addr = {};
-        addr.sin_family = AF_INET;
-        addr.sin_port = ntohs(1234);
-        addr.sin_addr.s_addr = ntohl(INADDR_LOOPBACK);  // 127.0.0.1
-        int rv = connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr));
-        if (rv) {
-            die("connect");
+        Connection conn;
+        int rv = conn.connect(host, port);
+        if (rv < 0) {
+            msg(std::string("connect: ") + strerror(-rv));
+            return 1;
         }
 
-        std::vector<std::string> cmd;
-        for (int i = 1; i < argc; ++i) {
+        std::vector<std::string_view> cmd;
+        for (int i = argi; i < argc; ++i) {
             cmd.push_back(argv[i]);
         }
-        int32_t err = send_req(fd, cmd);
-        if (err) {
-            return err;
+        if (count > 1 || pipeline) {
+            return run_repeated(conn, cmd, count, pipeline) ? 1 : 0;
         }
-        err = read_res(fd);
-        if (err) {
-            return err;
+        rv = conn.call(cmd, &on_response);
+        if (rv < 0) {
+            msg(std::string("request failed: ") + strerror(-rv));
+            return 1;
         }
-
         return 0;
     }
 };
 
+bool NetworkClient::quiet = false;
+
 int main(int argc, char** argv) {
     return NetworkClient::run(argc, argv);
 
     
-}
\ No newline at end of file
+}
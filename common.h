@@ -2,6 +2,10 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
 
 
 #define container_of(ptr, type, member) ({                  \
@@ -9,19 +13,78 @@
     (type *)( (char *)__mptr - offsetof(type, member) );})
 
 
-inline uint64_t str_hash(const uint8_t *data, size_t len) {
-    uint32_t h = 0x811C9DC5;
-    for (size_t i = 0; i < len; i++) {
-        h = (h + data[i]) * 0x01000193;
+// wyhash-style: 8 bytes per load and a 64x64->128 multiply to mix,
+// with three independent lanes over long keys. the seed is random per
+// process and goes into both factors of every multiply, so no key bytes
+// can zero one of them and colliding keys can't be precomputed.
+inline uint64_t hash_mum(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+inline uint64_t hash_r8(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t hash_r4(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t hash_seed_init() {
+    uint64_t seed = 0;
+    if (getrandom(&seed, sizeof(seed), 0) != (ssize_t)sizeof(seed)) {
+        seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
     }
-    return h;
+    return seed;
 }
 
-enum {
-    SER_NIL = 0,
-    SER_ERR = 1,
-    SER_STR = 2,
-    SER_INT = 3,
-    SER_DBL = 4,
-    SER_ARR = 5,
-};
+inline const uint64_t g_hash_seed = hash_seed_init();
+
+inline uint64_t str_hash(const uint8_t *data, size_t len) {
+    const uint64_t s0 = 0xa0761d6478bd642full, s1 = 0xe7037ed1a0b428dbull;
+    const uint64_t s2 = 0x8ebc6af09c88c6e3ull, s3 = 0x589965cc75374cc3ull;
+    const uint8_t *p = data;
+    uint64_t seed = g_hash_seed;
+    uint64_t a = 0, b = 0;
+    if (len <= 16) {
+        if (len >= 4) {
+            // two overlapping 4-byte reads from each end cover 4..16
+            size_t mid = (len >> 3) << 2;
+            a = (hash_r4(p) << 32) | hash_r4(p + mid);
+            b = (hash_r4(p + len - 4) << 32) | hash_r4(p + len - 4 - mid);
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = hash_mum(hash_r8(p) ^ s1 ^ seed, hash_r8(p + 8) ^ seed);
+                see1 = hash_mum(hash_r8(p + 16) ^ s2 ^ see1, hash_r8(p + 24) ^ see1);
+                see2 = hash_mum(hash_r8(p + 32) ^ s3 ^ see2, hash_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = hash_mum(hash_r8(p) ^ s1 ^ seed, hash_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping what was already mixed
+        a = hash_r8(p + i - 16);
+        b = hash_r8(p + i - 8);
+    }
+    a ^= s1 ^ seed;
+    b ^= s0 ^ seed;
+    __uint128_t r = (__uint128_t)a * b;
+    a = (uint64_t)r;
+    b = (uint64_t)(r >> 64);
+    return hash_mum(a ^ s0 ^ len, b ^ s1);
+}
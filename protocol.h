@@ -0,0 +1,13 @@
+#pragma once
+
+
+// the type tag in front of every serialized value in a reply, shared by
+// the server and the clients
+enum {
+    SER_NIL = 0,
+    SER_ERR = 1,
+    SER_STR = 2,
+    SER_INT = 3,
+    SER_DBL = 4,
+    SER_ARR = 5,
+};
@@ -6,20 +6,37 @@
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <time.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <malloc.h>
 #include <netinet/ip.h>
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <vector>
-#include "hashtable.h"
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include "slab.h"
+#include "swisstable.h"
 #include "zset.h"
 #include "list.h"
 #include "heap.h"
 #include "thread_pool.h"
 #include "common.h"
+#include "protocol.h"
+#include "spsc.h"
+#include "buffer.h"
+#ifdef USE_URING
+#include "uring.h"
+#endif
 
 
 static void msg(const char *msg) {
@@ -62,25 +79,149 @@ static void fd_set_nb(int fd) {
     }
 }
 
+enum {
+    T_STR = 0,
+    T_ZSET = 1,
+};
+
+enum {
+    ENT_TTL = 1,    // a heap index is stored in front of the key
+    ENT_INT = 2,    // a string held as `ival`, nothing follows the key
+};
+
+// a key and its value in one allocation: this header, the heap index
+// if the key ever had a TTL, the key, then for strings the value. the
+// value can grow in place up to `cap`, the rest of the slab block.
+// strings that are integers are kept in the header instead.
+struct Entry {
+    HashLink node;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t klen;
+    union {
+        struct {
+            uint32_t len;
+            uint32_t cap;
+        } val;
+        int64_t ival;
+        ZSet *zset;
+    };
+    char data[];
+};
+
+static size_t *entry_heap_idx(Entry *ent) {
+    return (ent->flags & ENT_TTL) ? (size_t *)ent->data : NULL;
+}
+
+static Entry *entry_of_heap_idx(size_t *idx) {
+    return (Entry *)((char *)idx - offsetof(Entry, data));
+}
+
+static char *entry_key_ptr(const Entry *ent) {
+    return (char *)ent->data + ((ent->flags & ENT_TTL) ? sizeof(size_t) : 0);
+}
+
+static std::string_view entry_key(const Entry *ent) {
+    return std::string_view(entry_key_ptr(ent), ent->klen);
+}
+
+static std::string_view entry_val(const Entry *ent) {
+    assert(ent->type == T_STR && !(ent->flags & ENT_INT));
+    return std::string_view(entry_key_ptr(ent) + ent->klen, ent->val.len);
+}
+
+// the bytes before the value
+static size_t entry_fixed(bool ttl, size_t klen) {
+    return sizeof(Entry) + (ttl ? sizeof(size_t) : 0) + klen;
+}
+
+// room for `vlen` bytes of value, plus the heap index if `ttl`
+static Entry *entry_alloc(std::string_view key, uint8_t type, bool ttl, size_t vlen) {
+    size_t fixed = entry_fixed(ttl, key.size());
+    Entry *ent = (Entry *)slab_alloc(fixed + vlen);
+    ent->type = type;
+    ent->flags = ttl ? ENT_TTL : 0;
+    ent->klen = (uint32_t)key.size();
+    if (ttl) {
+        *entry_heap_idx(ent) = (size_t)-1;
+    }
+    memcpy(entry_key_ptr(ent), key.data(), key.size());
+    if (type == T_STR) {
+        size_t cap = slab_usable(ent, fixed + vlen) - fixed;
+        ent->val.len = 0;
+        ent->val.cap = (uint32_t)std::min(cap, (size_t)UINT32_MAX);
+    } else {
+        ent->zset = NULL;
+    }
+    return ent;
+}
+
+// just the block, see entry_destroy() for the value
+static void entry_free(Entry *ent) {
+    size_t size = entry_fixed(ent->flags & ENT_TTL, ent->klen);
+    if (ent->type == T_STR && !(ent->flags & ENT_INT)) {
+        size += ent->val.cap;
+    }
+    slab_free(ent, size);
+}
+
+struct EntryKey {
+    std::string_view operator()(const Entry &ent) const { return entry_key(&ent); }
+};
+
+typedef IntrusiveMap<Entry, offsetof(Entry, node), EntryKey> EntryMap;
+
 struct Conn;
+struct ShardMsg;
 
-static struct {
-    HMap db;
+// everything one event loop owns. with --threads N there is one shard
+// per thread and the keyspace is partitioned between them by shard_of().
+struct Shard {
+    uint32_t id = 0;
+    EntryMap db;
     std::vector<Conn *> fd2conn;
+    std::vector<Conn *> conn_pool;  // closed connections to reuse
     DList idle_list;
     std::vector<HeapItem> heap;
-    TheadPool tp;
-} g_data;
+    int listen_fd = -1;
+    int epfd = -1;
+    bool uring = false;     // completion-based I/O, see uring_loop()
+    // cross-shard messaging
+    int wake_fd = -1;       // eventfd, signalled after pushing to our queues
+    std::vector<std::deque<ShardMsg *>> outbox;     // per target, when its queue is full
+    std::vector<uint8_t> dirty;                     // targets to signal
+    // calls per g_cmds entry, only written by this shard
+    std::unique_ptr<std::atomic<uint64_t>[]> calls;
+#ifdef USE_URING
+    URing ring;
+    URingBufs bufs;
+    std::vector<Conn *> nobufs;     // recvs to re-arm after ENOBUFS
+    uint64_t wake_buf = 0;
+#endif
+};
+
+static TheadPool g_tp;
+static std::vector<Shard *> g_shards;
+static std::unique_ptr<SPSCQueue[]> g_queues;  // [src * nshards + dst]
+static bool g_force_epoll = false;
+static thread_local Shard *g_data = NULL;
 
 
 
-const size_t k_max_msg = 4096;
+// largest request or response, set with --max-msg
+static size_t g_max_msg = 64 << 20;
+// for new sorted sets, --zset-index
+static ZIndex g_zset_index = ZINDEX_AVL;
+// stop serving a pipelining client that doesn't read its responses
+const size_t k_max_outq = 256 * 1024;
+const int k_max_iov = 64;
 
 
 enum {
     STATE_REQ = 0,
     STATE_RES = 1,
     STATE_END = 2,  
+    STATE_WAIT = 3,     // the request is being served by another shard
 };
 
 
@@ -88,13 +229,24 @@ enum {
 struct Conn {
     int fd = -1;
     uint32_t state = 0;    
-    size_t rbuf_size = 0;
-    uint8_t rbuf[4 + k_max_msg];
-    size_t wbuf_size = 0;
-    size_t wbuf_sent = 0;
-    uint8_t wbuf[4 + k_max_msg];
+    InBuf in;       // requests not served yet
+    ChainBuf out;   // responses not written yet
+    std::vector<std::string_view> args;     // of the request served, point into `in`
     uint64_t idle_start = 0;
     DList idle_list;
+    uint32_t events = 0;    // interest currently registered with epoll
+    bool rdhup = false;     // epoll saw the peer's FIN, read on to the EOF
+    uint32_t waiting = 0;   // replies outstanding from other shards
+    struct Gather *gather = NULL;   // merged reply of a fanned out command
+#ifdef USE_URING
+    uint32_t inflight = 0;  // SQEs the kernel still holds a reference for
+    bool closed = false;
+    int32_t in_bid = -1;    // provided buffer not yet copied into `in`
+    uint32_t in_off = 0;
+    uint32_t in_len = 0;
+    std::vector<struct iovec> iov;  // of the SENDMSG in flight
+    struct msghdr mh;
+#endif
 };
 
 
@@ -107,42 +259,101 @@ static void conn_put(std::vector<Conn *> &fd2conn, struct Conn *conn) {
     fd2conn[conn->fd] = conn;
 }
 
-static int32_t accept_new_conn(int fd) {
-        struct sockaddr_in client_addr = {};
-        socklen_t socklen = sizeof(client_addr);
-        int connfd = accept(fd, (struct sockaddr *)&client_addr, &socklen);
-        if (connfd < 0) {
-            msg("accept() error");
-            return -1;  
-    }
+// edge-triggered: the interest set only changes when the state does.
+// EPOLLRDHUP tells state_req() a short read isn't the end.
+static uint32_t conn_events(Conn *conn) {
+    return ((conn->state == STATE_REQ) ? EPOLLIN : EPOLLOUT) | EPOLLRDHUP | EPOLLET;
+}
 
+static void conn_update_events(Conn *conn) {
+    if (conn->state == STATE_WAIT) {
+        return;
+    }
+    uint32_t events = conn_events(conn);
+    if (events == conn->events) {
+        return;
+    }
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = conn->fd;
+    if (epoll_ctl(g_data->epfd, EPOLL_CTL_MOD, conn->fd, &ev)) {
+        die("epoll_ctl(MOD)");
+    }
+    conn->events = events;
+}
 
-    fd_set_nb(connfd);
+// closed Conns kept per shard, with whatever their vectors had grown to
+const size_t k_conn_pool_max = 1024;
 
-    struct Conn *conn = (struct Conn *)malloc(sizeof(struct Conn));
-    if (!conn) {
-        close(connfd);
-        return -1;
+static Conn *conn_new(int connfd) {
+    Conn *conn = NULL;
+    if (!g_data->conn_pool.empty()) {
+        conn = g_data->conn_pool.back();
+        g_data->conn_pool.pop_back();
+    } else {
+        conn = new Conn();
     }
     conn->fd = connfd;
     conn->state = STATE_REQ;
-    conn->rbuf_size = 0;
-    conn->wbuf_size = 0;
-    conn->wbuf_sent = 0;
     conn->idle_start = get_monotonic_usec();
-    dlist_insert_before(&g_data.idle_list, &conn->idle_list);
-    conn_put(g_data.fd2conn, conn);
+    conn->events = conn_events(conn);
+    dlist_insert_before(&g_data->idle_list, &conn->idle_list);
+    conn_put(g_data->fd2conn, conn);
+    return conn;
+}
+
+static void conn_done(Conn *conn);
+
+// returns -1 once nothing more can be accepted
+static int32_t accept_new_conn(int fd) {
+    int connfd = accept4(fd, NULL, NULL, SOCK_NONBLOCK);
+    if (connfd < 0) {
+        if (errno == ECONNABORTED || errno == EINTR) {
+            return 0;   // gone already, try the next one
+        }
+        if (errno != EAGAIN) {
+            msg("accept() error");
+        }
+        return -1;
+    }
+
+    Conn *conn = conn_new(connfd);
+    struct epoll_event ev = {};
+    ev.events = conn->events;
+    ev.data.fd = connfd;
+    if (epoll_ctl(g_data->epfd, EPOLL_CTL_ADD, connfd, &ev)) {
+        msg("epoll_ctl(ADD) error");
+        conn_done(conn);
+    }
     return 0;
 }
 
+// connections accepted per loop iteration, so a connect storm can't
+// hold up the established ones
+const int k_accept_budget = 256;
+
+// returns true if the budget ran out before the backlog did
+static bool accept_burst(int fd) {
+    for (int i = 0; i < k_accept_budget; ++i) {
+        if (accept_new_conn(fd) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void state_req(Conn *conn);
 static void state_res(Conn *conn);
 
-const size_t k_max_args = 1024;
+// enough for a ZADD of 500k pairs, the message size is the real limit
+const size_t k_max_args = 1 << 20;
 
+// the arguments are views into `data`, only valid until the input
+// buffer is refilled; whatever a command keeps it has to copy
 static int32_t parse_req(
-    const uint8_t *data, size_t len, std::vector<std::string> &out)
+    const uint8_t *data, size_t len, std::vector<std::string_view> &out)
 {
+    out.clear();
     if (len < 4) {
         return -1;
     }
@@ -162,7 +373,7 @@ static int32_t parse_req(
         if (pos + 4 + sz > len) {
             return -1;
         }
-        out.push_back(std::string((char *)&data[pos + 4], sz));
+        out.emplace_back((const char *)&data[pos + 4], sz);
         pos += 4 + sz;
     }
 
@@ -173,198 +384,356 @@ static int32_t parse_req(
 }
 
 enum {
-    T_STR = 0,
-    T_ZSET = 1,
+    ERR_UNKNOWN = 1,
+    ERR_2BIG = 2,
+    ERR_TYPE = 3,
+    ERR_ARG = 4,
 };
 
-
-
-struct Entry {
-    struct HNode node;
-    std::string key;
-    std::string val;
-    uint32_t type = 0;
-    ZSet *zset = NULL;
-
-    size_t heap_idx = -1;
+// serializes a reply straight into an output chain. a framed reply
+// reserves its 4-byte length up front and out_end() fills it in.
+struct RespWriter {
+    ChainBuf *buf = NULL;
+    ChainMark start;        // first byte of the reply
+    uint8_t *len = NULL;    // NULL when unframed
 };
 
-static bool entry_eq(HNode *lhs, HNode *rhs) {
-    struct Entry *le = container_of(lhs, struct Entry, node);
-    struct Entry *re = container_of(rhs, struct Entry, node);
-    return le->key == re->key;
+// unframed, for a reply that becomes part of another
+static void out_init(RespWriter &out, ChainBuf *buf) {
+    out.buf = buf;
+    out.start = chain_mark(buf);
+    out.len = NULL;
 }
 
-enum {
-    ERR_UNKNOWN = 1,
-    ERR_2BIG = 2,
-    ERR_TYPE = 3,
-    ERR_ARG = 4,
-};
+static void out_begin(RespWriter &out, ChainBuf *buf) {
+    uint8_t *len = chain_reserve(buf, 4);
+    out_init(out, buf);
+    out.len = len;
+}
+
+static uint8_t *out_reserve(RespWriter &out, uint8_t tag, size_t n) {
+    uint8_t *p = chain_reserve(out.buf, 1 + n);
+    p[0] = tag;
+    return &p[1];
+}
 
-static void out_nil(std::string &out) {
-    out.push_back(SER_NIL);
+static void out_nil(RespWriter &out) {
+    (void)out_reserve(out, SER_NIL, 0);
 }
 
-static void out_str(std::string &out, const char *s, size_t size) {
-    out.push_back(SER_STR);
+static void out_str(RespWriter &out, const char *s, size_t size) {
     uint32_t len = (uint32_t)size;
-    out.append((char *)&len, 4);
-    out.append(s, len);
+    memcpy(out_reserve(out, SER_STR, 4), &len, 4);
+    chain_append(out.buf, s, len);
 }
 
-static void out_str(std::string &out, const std::string &val) {
+static void out_str(RespWriter &out, std::string_view val) {
     return out_str(out, val.data(), val.size());
 }
 
-static void out_int(std::string &out, int64_t val) {
-    out.push_back(SER_INT);
-    out.append((char *)&val, 8);
+static void out_int(RespWriter &out, int64_t val) {
+    memcpy(out_reserve(out, SER_INT, 8), &val, 8);
 }
 
-static void out_dbl(std::string &out, double val) {
-    out.push_back(SER_DBL);
-    out.append((char *)&val, 8);
+static void out_dbl(RespWriter &out, double val) {
+    memcpy(out_reserve(out, SER_DBL, 8), &val, 8);
 }
 
-static void out_err(std::string &out, int32_t code, const std::string &msg) {
-    out.push_back(SER_ERR);
-    out.append((char *)&code, 4);
+static void out_err(RespWriter &out, int32_t code, std::string_view msg) {
+    uint8_t *p = out_reserve(out, SER_ERR, 8);
     uint32_t len = (uint32_t)msg.size();
-    out.append((char *)&len, 4);
-    out.append(msg);
+    memcpy(&p[0], &code, 4);
+    memcpy(&p[4], &len, 4);
+    chain_append(out.buf, msg.data(), msg.size());
+}
+
+static void out_arr(RespWriter &out, uint32_t n) {
+    memcpy(out_reserve(out, SER_ARR, 4), &n, 4);
+}
+
+// an array whose size is only known at the end, returns where it goes
+static uint8_t *begin_arr(RespWriter &out) {
+    uint8_t *n = out_reserve(out, SER_ARR, 4);
+    memset(n, 0, 4);
+    return n;
 }
 
-static void out_arr(std::string &out, uint32_t n) {
-    out.push_back(SER_ARR);
-    out.append((char *)&n, 4);
+static void end_arr(RespWriter &out, uint8_t *pos, uint32_t n) {
+    (void)out;
+    assert(pos[-1] == SER_ARR);
+    memcpy(pos, &n, 4);
 }
 
-static void *begin_arr(std::string &out) {
-    out.push_back(SER_ARR);
-    out.append("\0\0\0\0", 4);          
-    return (void *)(out.size() - 4);   
+// fill in the length of a framed reply, one that grew too big is
+// replaced with an error
+static void out_end(RespWriter &out) {
+    assert(out.len);
+    if (4 + out.buf->size - out.start.size > g_max_msg) {
+        chain_truncate(out.buf, out.start);
+        out_err(out, ERR_2BIG, "response is too big");
+    }
+    uint32_t len = (uint32_t)(out.buf->size - out.start.size);
+    memcpy(out.len, &len, 4);
 }
 
 
 
+static bool str2int(std::string_view s, int64_t &out) {
+    const char *end = s.data() + s.size();
+    std::from_chars_result rv = std::from_chars(s.data(), end, out);
+    return rv.ec == std::errc() && rv.ptr == end;
+}
 
-static void end_arr(std::string &out, void *ctx, uint32_t n) {
-    size_t pos = (size_t)ctx;
-    assert(out[pos - 1] == SER_ARR);
-    memcpy(&out[pos], &n, 4);
+static bool str2dbl(std::string_view s, double &out) {
+    const char *end = s.data() + s.size();
+    std::from_chars_result rv = std::from_chars(s.data(), end, out);
+    return rv.ec == std::errc() && rv.ptr == end && !isnan(out);
 }
 
+// the longest int64 and the longest shortest-form double
+const size_t k_num_buf = 32;
 
+static std::string_view int2str(int64_t v, char *buf) {
+    std::to_chars_result rv = std::to_chars(buf, buf + k_num_buf, v);
+    return std::string_view(buf, rv.ptr - buf);
+}
 
-static void do_get(std::vector<std::string> &cmd, std::string &out) {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+// only the form int2str() gives back, so GET returns what was SET
+static bool str2int_exact(std::string_view s, int64_t &out) {
+    char buf[k_num_buf];
+    return s.size() <= 20 && str2int(s, out) && int2str(out, buf) == s;
+}
 
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (!node) {
+static void do_get(std::vector<std::string_view> &cmd, RespWriter &out) {
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (!ent) {
         return out_nil(out);
     }
-
-    Entry *ent = container_of(node, Entry, node);
     if (ent->type != T_STR) {
         return out_err(out, ERR_TYPE, "expect string type");
     }
-    return out_str(out, ent->val);
+    if (ent->flags & ENT_INT) {
+        char buf[k_num_buf];
+        return out_str(out, int2str(ent->ival, buf));
+    }
+    return out_str(out, entry_val(ent));
 }
 
 
 
 
-static void do_set(std::vector<std::string> &cmd, std::string &out) {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
+// move a keyspace entry to a new allocation, with room for `vlen` bytes
+// of value and for a heap index if `ttl`. the value is kept if it fits.
+static Entry *entry_realloc(Entry *ent, bool ttl, size_t vlen) {
+    Entry *copy = entry_alloc(entry_key(ent), ent->type, ttl, vlen);
+    size_t *idx = entry_heap_idx(ent);
+    if (idx && *idx != (size_t)-1) {
+        assert(ttl);
+        *entry_heap_idx(copy) = *idx;
+        g_data->heap[*idx].ref = entry_heap_idx(copy);
+    }
+    if (ent->flags & ENT_INT) {
+        copy->flags |= ENT_INT;
+        copy->ival = ent->ival;
+    } else if (ent->type == T_STR) {
+        if (ent->val.len <= copy->val.cap) {
+            memcpy(entry_key_ptr(copy) + copy->klen, entry_val(ent).data(), ent->val.len);
+            copy->val.len = ent->val.len;
+        }
+    } else {
+        copy->zset = ent->zset;
+    }
+    g_data->db.replace(ent, copy);
+    entry_free(ent);
+    return copy;
+}
 
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (node) {
-        Entry *ent = container_of(node, Entry, node);
-        if (ent->type != T_STR) {
-            return out_err(out, ERR_TYPE, "expect string type");
+// make string entry `ent` an integer. in place, unless the block is
+// bigger than an integer entry would get.
+static Entry *entry_set_int(Entry *ent, int64_t v) {
+    if (!(ent->flags & ENT_INT)) {
+        size_t fixed = entry_fixed(ent->flags & ENT_TTL, ent->klen);
+        if (slab_usable(ent, fixed) < fixed + ent->val.cap) {
+            ent->val.len = 0;
+            ent = entry_realloc(ent, ent->flags & ENT_TTL, 0);
         }
-        ent->val.swap(cmd[2]);
+        ent->flags |= ENT_INT;
+    }
+    ent->ival = v;
+    return ent;
+}
+
+static Entry *entry_set_bytes(Entry *ent, std::string_view val) {
+    if (ent->flags & ENT_INT) {
+        // whatever the block has room for after the key
+        size_t fixed = entry_fixed(ent->flags & ENT_TTL, ent->klen);
+        ent->flags &= ~ENT_INT;
+        ent->val.len = 0;
+        ent->val.cap = (uint32_t)std::min(slab_usable(ent, fixed) - fixed, (size_t)UINT32_MAX);
+    }
+    // grow, or give back most of a value that got a lot smaller
+    if (val.size() > ent->val.cap
+        || (ent->val.cap > 256 && val.size() < ent->val.cap / 4))
+    {
+        ent->val.len = 0;   // not worth copying
+        ent = entry_realloc(ent, ent->flags & ENT_TTL, val.size());
+    }
+    memcpy(entry_key_ptr(ent) + ent->klen, val.data(), val.size());
+    ent->val.len = (uint32_t)val.size();
+    return ent;
+}
+
+// store `val` at `ent`, or at a new entry for `key` if NULL
+static void entry_set_str(Entry *ent, std::string_view key, std::string_view val) {
+    int64_t iv = 0;
+    bool is_int = str2int_exact(val, iv);
+    if (!ent) {
+        ent = entry_alloc(key, T_STR, false, is_int ? 0 : val.size());
+        g_data->db.insert(ent);
+    }
+    if (is_int) {
+        entry_set_int(ent, iv);
     } else {
-        Entry *ent = new Entry();
-        ent->key.swap(key.key);
-        ent->node.hcode = key.node.hcode;
-        ent->val.swap(cmd[2]);
-        hm_insert(&g_data.db, &ent->node);
+        entry_set_bytes(ent, val);
+    }
+}
+
+static void do_set(std::vector<std::string_view> &cmd, RespWriter &out) {
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (ent && ent->type != T_STR) {
+        return out_err(out, ERR_TYPE, "expect string type");
     }
+    entry_set_str(ent, cmd[1], cmd[2]);
     return out_nil(out);
 }
 
+static void entry_incr(std::string_view key, int64_t delta, RespWriter &out) {
+    Entry *ent = g_data->db.find(key);
+    int64_t v = 0;
+    if (ent && ent->type != T_STR) {
+        return out_err(out, ERR_TYPE, "expect string type");
+    }
+    if (ent && (ent->flags & ENT_INT)) {
+        v = ent->ival;
+    } else if (ent && !str2int_exact(entry_val(ent), v)) {
+        return out_err(out, ERR_ARG, "value is not an int64");
+    }
+    if (__builtin_add_overflow(v, delta, &v)) {
+        return out_err(out, ERR_ARG, "increment would overflow");
+    }
+    if (!ent) {
+        ent = entry_alloc(key, T_STR, false, 0);
+        g_data->db.insert(ent);
+    }
+    entry_set_int(ent, v);
+    return out_int(out, v);
+}
 
+static void do_incr(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return entry_incr(cmd[1], 1, out);
+}
 
-static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
-    if (ttl_ms < 0 && ent->heap_idx != (size_t)-1) {
+static void do_decr(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return entry_incr(cmd[1], -1, out);
+}
 
-        size_t pos = ent->heap_idx;
-        g_data.heap[pos] = g_data.heap.back();
-        g_data.heap.pop_back();
-        if (pos < g_data.heap.size()) {
-            heap_update(g_data.heap.data(), pos, g_data.heap.size());
-        }
-        ent->heap_idx = -1;
-    } else if (ttl_ms >= 0) {
-        size_t pos = ent->heap_idx;
-        if (pos == (size_t)-1) {
+static void do_incrby(std::vector<std::string_view> &cmd, RespWriter &out) {
+    int64_t delta = 0;
+    if (!str2int(cmd[2], delta)) {
+        return out_err(out, ERR_ARG, "expect int64");
+    }
+    return entry_incr(cmd[1], delta, out);
+}
 
-            HeapItem item;
-            item.ref = &ent->heap_idx;
-            g_data.heap.push_back(item);
-            pos = g_data.heap.size() - 1;
-        }
-        g_data.heap[pos].val = get_monotonic_usec() + (uint64_t)ttl_ms * 1000;
-        heap_update(g_data.heap.data(), pos, g_data.heap.size());
+static void do_decrby(std::vector<std::string_view> &cmd, RespWriter &out) {
+    int64_t delta = 0;
+    if (!str2int(cmd[2], delta) || delta == INT64_MIN) {
+        return out_err(out, ERR_ARG, "expect int64");
     }
+    return entry_incr(cmd[1], -delta, out);
 }
 
-static bool str2int(const std::string &s, int64_t &out) {
-    char *endp = NULL;
-    out = strtoll(s.c_str(), &endp, 10);
-    return endp == s.c_str() + s.size();
+// the result is stored in its shortest form, an integer one as such
+static void do_incrbyfloat(std::vector<std::string_view> &cmd, RespWriter &out) {
+    double delta = 0;
+    if (!str2dbl(cmd[2], delta)) {
+        return out_err(out, ERR_ARG, "expect fp number");
+    }
+    Entry *ent = g_data->db.find(cmd[1]);
+    double v = 0;
+    if (ent && ent->type != T_STR) {
+        return out_err(out, ERR_TYPE, "expect string type");
+    }
+    if (ent && (ent->flags & ENT_INT)) {
+        v = (double)ent->ival;
+    } else if (ent && !str2dbl(entry_val(ent), v)) {
+        return out_err(out, ERR_ARG, "value is not a number");
+    }
+    v += delta;
+    if (!isfinite(v)) {
+        return out_err(out, ERR_ARG, "increment would produce NaN or Infinity");
+    }
+    char buf[k_num_buf];
+    std::to_chars_result rv = std::to_chars(buf, buf + sizeof(buf), v);
+    entry_set_str(ent, cmd[1], std::string_view(buf, rv.ptr - buf));
+    return out_dbl(out, v);
+}
+
+static void entry_set_ttl(Entry *ent, int64_t ttl_ms) {
+    size_t *idx = entry_heap_idx(ent);
+    if (ttl_ms < 0) {
+        if (idx && *idx != (size_t)-1) {
+            size_t pos = *idx;
+            g_data->heap[pos] = g_data->heap.back();
+            g_data->heap.pop_back();
+            if (pos < g_data->heap.size()) {
+                Heap::update(g_data->heap, pos);
+            }
+            *idx = -1;
+        }
+        return;
+    }
+    if (!idx) {
+        // the first TTL this key gets, make room for the heap index
+        bool bytes = ent->type == T_STR && !(ent->flags & ENT_INT);
+        ent = entry_realloc(ent, true, bytes ? ent->val.len : 0);
+        idx = entry_heap_idx(ent);
+    }
+    size_t pos = *idx;
+    if (pos == (size_t)-1) {
+        HeapItem item;
+        item.ref = idx;
+        g_data->heap.push_back(item);
+        pos = g_data->heap.size() - 1;
+    }
+    g_data->heap[pos].val = get_monotonic_usec() + (uint64_t)ttl_ms * 1000;
+    Heap::update(g_data->heap, pos);
 }
 
-static void do_expire(std::vector<std::string> &cmd, std::string &out) {
+static void do_expire(std::vector<std::string_view> &cmd, RespWriter &out) {
     int64_t ttl_ms = 0;
     if (!str2int(cmd[2], ttl_ms)) {
         return out_err(out, ERR_ARG, "expect int64");
     }
 
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (node) {
-        Entry *ent = container_of(node, Entry, node);
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (ent) {
         entry_set_ttl(ent, ttl_ms);
     }
-    return out_int(out, node ? 1: 0);
+    return out_int(out, ent ? 1: 0);
 }
 
-static void do_ttl(std::vector<std::string> &cmd, std::string &out) {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-
-    HNode *node = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (!node) {
+static void do_ttl(std::vector<std::string_view> &cmd, RespWriter &out) {
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (!ent) {
         return out_int(out, -2);
     }
-
-    Entry *ent = container_of(node, Entry, node);
-    if (ent->heap_idx == (size_t)-1) {
+    size_t *idx = entry_heap_idx(ent);
+    if (!idx || *idx == (size_t)-1) {
         return out_int(out, -1);
     }
 
-    uint64_t expire_at = g_data.heap[ent->heap_idx].val;
+    uint64_t expire_at = g_data->heap[*idx].val;
     uint64_t now_us = get_monotonic_usec();
     return out_int(out, expire_at > now_us ? (expire_at - now_us) / 1000 : 0);
 }
@@ -374,11 +743,10 @@ static void do_ttl(std::vector<std::string> &cmd, std::string &out) {
 static void entry_destroy(Entry *ent) {
     switch (ent->type) {
     case T_ZSET:
-        zset_dispose(ent->zset);
         delete ent->zset;
         break;
     }
-    delete ent;
+    entry_free(ent);
 }
 
 static void entry_del_async(void *arg) {
@@ -395,108 +763,175 @@ static void entry_del(Entry *ent) {
     bool too_big = false;
     switch (ent->type) {
     case T_ZSET:
-        too_big = hm_size(&ent->zset->hmap) > k_large_container_size;
+        too_big = ent->zset->size() > k_large_container_size;
         break;
     }
 
     if (too_big) {
-        thread_pool_queue(&g_data.tp, &entry_del_async, ent);
+        thread_pool_queue(&g_tp, &entry_del_async, ent);
     } else {
         entry_destroy(ent);
     }
 }
 
-static void do_del(std::vector<std::string> &cmd, std::string &out) {
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-
-    HNode *node = hm_pop(&g_data.db, &key.node, &entry_eq);
-    if (node) {
-        entry_del(container_of(node, Entry, node));
-    }
-    return out_int(out, node ? 1 : 0);
-}
-
-static void h_scan(HTab *tab, void (*f)(HNode *, void *), void *arg) {
-    if (tab->size == 0) {
-        return;
-    }
-    for (size_t i = 0; i < tab->mask + 1; ++i) {
-        HNode *node = tab->tab[i];
-        while (node) {
-            f(node, arg);
-            node = node->next;
-        }
+static void do_del(std::vector<std::string_view> &cmd, RespWriter &out) {
+    Entry *ent = g_data->db.erase(cmd[1]);
+    if (ent) {
+        entry_del(ent);
     }
+    return out_int(out, ent ? 1 : 0);
 }
 
-static void cb_scan(HNode *node, void *arg) {
-    std::string &out = *(std::string *)arg;
-    out_str(out, container_of(node, Entry, node)->key);
-}
 
-static void do_keys(std::vector<std::string> &cmd, std::string &out) {
-    (void)cmd;
-    out_arr(out, (uint32_t)hm_size(&g_data.db));
-    h_scan(&g_data.db.ht1, &cb_scan, &out);
-    h_scan(&g_data.db.ht2, &cb_scan, &out);
-}
 
-static bool str2dbl(const std::string &s, double &out) {
-    char *endp = NULL;
-    out = strtod(s.c_str(), &endp);
-    return endp == s.c_str() + s.size() && !isnan(out);
+static bool cmd_is(std::string_view word, const char *cmd) {
+    return word.size() == strlen(cmd)
+        && 0 == strncasecmp(word.data(), cmd, word.size());
 }
 
+enum {
+    ZADD_NX = 1,        // only add new members
+    ZADD_XX = 2,        // only update existing ones
+    ZADD_GT = 4,        // only update to a greater score
+    ZADD_LT = 8,        // or a lesser one
+    ZADD_INCR = 16,     // add to the score, one pair only
+};
 
+// whether `flags` let a member scored `old` get `score`
+static bool zadd_allowed(uint32_t flags, double old, double score) {
+    return !(flags & ZADD_NX)
+        && !((flags & ZADD_GT) && score <= old)
+        && !((flags & ZADD_LT) && score >= old);
+}
 
-static void do_zadd(std::vector<std::string> &cmd, std::string &out) {
-    double score = 0;
-    if (!str2dbl(cmd[2], score)) {
-        return out_err(out, ERR_ARG, "expect fp number");
+// zadd key [nx|xx] [gt|lt] [incr] score name [score name ...], replies
+// the members added, or with incr the new score or nil if not updated
+static void do_zadd(std::vector<std::string_view> &cmd, RespWriter &out) {
+    uint32_t flags = 0;
+    size_t i = 2;
+    for (; i < cmd.size(); ++i) {
+        if (cmd_is(cmd[i], "nx")) {
+            flags |= ZADD_NX;
+        } else if (cmd_is(cmd[i], "xx")) {
+            flags |= ZADD_XX;
+        } else if (cmd_is(cmd[i], "gt")) {
+            flags |= ZADD_GT;
+        } else if (cmd_is(cmd[i], "lt")) {
+            flags |= ZADD_LT;
+        } else if (cmd_is(cmd[i], "incr")) {
+            flags |= ZADD_INCR;
+        } else {
+            break;
+        }
     }
-
-
-
-    Entry key;
-    key.key.swap(cmd[1]);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-    HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
-
-    Entry *ent = NULL;
-    if (!hnode) {
-        ent = new Entry();
-        ent->key.swap(key.key);
-        ent->node.hcode = key.node.hcode;
-        ent->type = T_ZSET;
-        ent->zset = new ZSet();
-        hm_insert(&g_data.db, &ent->node);
-    } else {
-        ent = container_of(hnode, Entry, node);
-        if (ent->type != T_ZSET) {
-            return out_err(out, ERR_TYPE, "expect zset");
+    size_t npairs = (cmd.size() - i) / 2;
+    if (npairs == 0 || (cmd.size() - i) % 2) {
+        return out_err(out, ERR_ARG, "expect score name pairs");
+    }
+    if (((flags & ZADD_NX) && (flags & (ZADD_XX | ZADD_GT | ZADD_LT)))
+        || ((flags & ZADD_GT) && (flags & ZADD_LT)))
+    {
+        return out_err(out, ERR_ARG, "nx, xx, gt and lt don't combine");
+    }
+    if ((flags & ZADD_INCR) && npairs != 1) {
+        return out_err(out, ERR_ARG, "incr takes one pair");
+    }
+    // a single pair, the usual case, is parsed into `one` and never
+    // touches the heap; only several go through the batch below
+    ZPair one;
+    std::vector<ZPair> pairs(npairs > 1 ? npairs : 0);
+    ZPair *parsed = npairs > 1 ? pairs.data() : &one;
+    for (size_t j = 0; j < npairs; ++j) {
+        if (!str2dbl(cmd[i + 2 * j], parsed[j].score)) {
+            return out_err(out, ERR_ARG, "expect fp number");
         }
+        parsed[j].name = cmd[i + 2 * j + 1];
     }
 
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (ent && ent->type != T_ZSET) {
+        return out_err(out, ERR_TYPE, "expect zset");
+    }
+    if (!ent && (flags & ZADD_XX)) {
+        return (flags & ZADD_INCR) ? out_nil(out) : out_int(out, 0);
+    }
+    if (!ent) {
+        ent = entry_alloc(cmd[1], T_ZSET, false, 0);
+        ent->zset = new ZSet(g_zset_index);
+        g_data->db.insert(ent);
+    }
+    ZSet *zset = ent->zset;
 
+    if (flags & ZADD_INCR) {
+        double score = 0;
+        bool found = zset->lookup(one.name, score);
+        if (found ? (flags & ZADD_NX) : (flags & ZADD_XX)) {
+            return out_nil(out);
+        }
+        double sum = score + one.score;
+        if (isnan(sum)) {
+            return out_err(out, ERR_ARG, "the score would be NaN");
+        }
+        if (found && !zadd_allowed(flags, score, sum)) {
+            return out_nil(out);
+        }
+        zset->add(one.name, sum);
+        return out_dbl(out, sum);
+    }
+    if (npairs == 1) {
+        double old = 0;
+        if (!zset->lookup(one.name, old)) {
+            if (flags & ZADD_XX) {
+                return out_int(out, 0);
+            }
+            zset->add(one.name, one.score);
+            return out_int(out, 1);
+        }
+        if (zadd_allowed(flags, old, one.score)) {
+            zset->add(one.name, one.score);
+        }
+        return out_int(out, 0);
+    }
 
-    const std::string &name = cmd[3];
-    bool added = zset_add(ent->zset, name.data(), name.size(), score);
-    return out_int(out, (int64_t)added);
+    // one pair per name, the one adding them in turn would leave: the
+    // first under nx, the greatest or least under gt or lt, else the last
+    std::stable_sort(pairs.begin(), pairs.end(), [](const ZPair &a, const ZPair &b) {
+        return a.name < b.name;
+    });
+    size_t n = 0;
+    for (size_t j = 0; j < pairs.size(); ++j) {
+        if (n > 0 && pairs[n - 1].name == pairs[j].name) {
+            if (zadd_allowed(flags, pairs[n - 1].score, pairs[j].score)) {
+                pairs[n - 1].score = pairs[j].score;
+            }
+        } else {
+            pairs[n++] = pairs[j];
+        }
+    }
+    pairs.resize(n);
+
+    // existing members are updated in place, the new ones go in together
+    std::vector<ZPair> fresh;
+    for (const ZPair &p : pairs) {
+        double old = 0;
+        if (!zset->lookup(p.name, old)) {
+            if (!(flags & ZADD_XX)) {
+                fresh.push_back(p);
+            }
+        } else if (zadd_allowed(flags, old, p.score)) {
+            zset->add(p.name, p.score);
+        }
+    }
+    zset->addNew(fresh);
+    return out_int(out, (int64_t)fresh.size());
 }
 
-static bool expect_zset(std::string &out, std::string &s, Entry **ent) {
-    Entry key;
-    key.key.swap(s);
-    key.node.hcode = str_hash((uint8_t *)key.key.data(), key.key.size());
-    HNode *hnode = hm_lookup(&g_data.db, &key.node, &entry_eq);
-    if (!hnode) {
+static bool expect_zset(RespWriter &out, std::string_view s, Entry **ent) {
+    *ent = g_data->db.find(s);
+    if (!*ent) {
         out_nil(out);
         return false;
     }
-
-    *ent = container_of(hnode, Entry, node);
     if ((*ent)->type != T_ZSET) {
         out_err(out, ERR_TYPE, "expect zset");
         return false;
@@ -506,43 +941,39 @@ static bool expect_zset(std::string &out, std::string &s, Entry **ent) {
 
 
 
-static void do_zrem(std::vector<std::string> &cmd, std::string &out) {
+static void do_zrem(std::vector<std::string_view> &cmd, RespWriter &out) {
     Entry *ent = NULL;
     if (!expect_zset(out, cmd[1], &ent)) {
         return;
     }
 
-    const std::string &name = cmd[2];
-    ZNode *znode = zset_pop(ent->zset, name.data(), name.size());
-    if (znode) {
-        znode_del(znode);
-    }
-    return out_int(out, znode ? 1 : 0);
+    std::string_view name = cmd[2];
+    return out_int(out, ent->zset->remove(name) ? 1 : 0);
 }
 
 
 
-static void do_zscore(std::vector<std::string> &cmd, std::string &out) {
+static void do_zscore(std::vector<std::string_view> &cmd, RespWriter &out) {
     Entry *ent = NULL;
     if (!expect_zset(out, cmd[1], &ent)) {
         return;
     }
 
-    const std::string &name = cmd[2];
-    ZNode *znode = zset_lookup(ent->zset, name.data(), name.size());
-    return znode ? out_dbl(out, znode->score) : out_nil(out);
+    std::string_view name = cmd[2];
+    double score = 0;
+    return ent->zset->lookup(name, score) ? out_dbl(out, score) : out_nil(out);
 }
 
 
 
-static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
+static void do_zquery(std::vector<std::string_view> &cmd, RespWriter &out) {
 
 
     double score = 0;
     if (!str2dbl(cmd[2], score)) {
         return out_err(out, ERR_ARG, "expect fp number");
     }
-    const std::string &name = cmd[3];
+    std::string_view name = cmd[3];
     int64_t offset = 0;
     int64_t limit = 0;
     if (!str2int(cmd[4], offset)) {
@@ -554,13 +985,12 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
 
 
 
-    Entry *ent = NULL;
-    if (!expect_zset(out, cmd[1], &ent)) {
-        if (out[0] == SER_NIL) {
-            out.clear();
-            out_arr(out, 0);
-        }
-        return;
+    Entry *ent = g_data->db.find(cmd[1]);
+    if (!ent) {
+        return out_arr(out, 0);
+    }
+    if (ent->type != T_ZSET) {
+        return out_err(out, ERR_TYPE, "expect zset");
     }
 
 
@@ -568,121 +998,733 @@ static void do_zquery(std::vector<std::string> &cmd, std::string &out) {
     if (limit <= 0) {
         return out_arr(out, 0);
     }
-    ZNode *znode = zset_query(ent->zset, score, name.data(), name.size());
-    znode = znode_offset(znode, offset);
+    ZIter it = ent->zset->seek(score, name);
+    ent->zset->advance(it, offset);
 
 
 
-    void *arr = begin_arr(out);
+    uint8_t *arr = begin_arr(out);
     uint32_t n = 0;
-    while (znode && (int64_t)n < limit) {
-        out_str(out, znode->name, znode->len);
-        out_dbl(out, znode->score);
-        znode = znode_offset(znode, +1);
+    while (it.valid() && (int64_t)n < limit) {
+        out_str(out, it.name());
+        out_dbl(out, it.score());
+        ent->zset->advance(it, +1);
         n += 2;
     }
     end_arr(out, arr, n);
 }
 
-static bool cmd_is(const std::string &word, const char *cmd) {
-    return 0 == strcasecmp(word.c_str(), cmd);
-}
-
-static void do_request(std::vector<std::string> &cmd, std::string &out) {
-    if (cmd.size() == 1 && cmd_is(cmd[0], "keys")) {
-        do_keys(cmd, out);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "get")) {
-        do_get(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "set")) {
-        do_set(cmd, out);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "del")) {
-        do_del(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "pexpire")) {
-        do_expire(cmd, out);
-    } else if (cmd.size() == 2 && cmd_is(cmd[0], "pttl")) {
-        do_ttl(cmd, out);
-    } else if (cmd.size() == 4 && cmd_is(cmd[0], "zadd")) {
-        do_zadd(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "zrem")) {
-        do_zrem(cmd, out);
-    } else if (cmd.size() == 3 && cmd_is(cmd[0], "zscore")) {
-        do_zscore(cmd, out);
-    } else if (cmd.size() == 6 && cmd_is(cmd[0], "zquery")) {
-        do_zquery(cmd, out);
-    } else {
-
+static const char *const k_zindex_names[] = {"avl", "btree"};
 
-        out_err(out, ERR_UNKNOWN, "Unknown cmd");
+static bool parse_zindex(std::string_view s, ZIndex &out) {
+    for (size_t i = 0; i < 2; ++i) {
+        if (cmd_is(s, k_zindex_names[i])) {
+            out = (ZIndex)i;
+            return true;
+        }
     }
+    return false;
 }
 
-static bool try_one_request(Conn *conn) {
-
-    if (conn->rbuf_size < 4) {
-        return false;
+// zindex key [avl|btree], switches the set's index if given and
+// replies the one it has, or "packed" for a small set yet to get one
+static void do_zindex(std::vector<std::string_view> &cmd, RespWriter &out) {
+    ZIndex to = ZINDEX_AVL;
+    if (cmd.size() > 3 || (cmd.size() == 3 && !parse_zindex(cmd[2], to))) {
+        return out_err(out, ERR_ARG, "expect avl or btree");
     }
-
-
-    uint32_t len = 0;
-    memcpy(&len, &conn->rbuf[0], 4);
-    if (len > k_max_msg) {
-        msg("too long");
-        conn->state = STATE_END;
-        return false;
+    Entry *ent = NULL;
+    if (!expect_zset(out, cmd[1], &ent)) {
+        return;
     }
-    if (4 + len > conn->rbuf_size) {
-
-        return false;
+    if (cmd.size() == 3) {
+        ent->zset->setIndex(to);
     }
+    if (ent->zset->isPacked()) {
+        return out_str(out, "packed");
+    }
+    return out_str(out, k_zindex_names[ent->zset->getIndex()]);
+}
 
-
-    std::vector<std::string> cmd;
-    if (0 != parse_req(&conn->rbuf[4], len, cmd)) {
-        msg("bad req");
-        conn->state = STATE_END;
+// like expect_zset(), but a missing key is an empty set: `*zset` is
+// left NULL and nothing is replied
+static bool find_zset(RespWriter &out, std::string_view s, ZSet **zset) {
+    *zset = NULL;
+    Entry *ent = g_data->db.find(s);
+    if (ent && ent->type != T_ZSET) {
+        out_err(out, ERR_TYPE, "expect zset");
         return false;
     }
+    if (ent) {
+        *zset = ent->zset;
+    }
+    return true;
+}
 
+// zrank key name, zrevrank key name
+static void zrank(std::vector<std::string_view> &cmd, RespWriter &out, bool rev) {
+    Entry *ent = NULL;
+    if (!expect_zset(out, cmd[1], &ent)) {
+        return;
+    }
+    double score = 0;
+    if (!ent->zset->lookup(cmd[2], score)) {
+        return out_nil(out);
+    }
+    uint64_t rank = ent->zset->rank(ent->zset->seek(score, cmd[2]));
+    return out_int(out, (int64_t)(rev ? ent->zset->size() - 1 - rank : rank));
+}
 
+static void do_zrank(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return zrank(cmd, out, false);
+}
 
-    std::string out;
-    do_request(cmd, out);
-
+static void do_zrevrank(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return zrank(cmd, out, true);
+}
 
+// a score range end: a number, -inf or +inf, exclusive with a "(" in front
+struct ScoreBound {
+    double score = 0;
+    bool excl = false;
+};
 
-    if (4 + out.size() > k_max_msg) {
-        out.clear();
-        out_err(out, ERR_2BIG, "response is too big");
+static bool parse_bound(std::string_view s, ScoreBound &out) {
+    out.excl = !s.empty() && s[0] == '(';
+    if (out.excl) {
+        s.remove_prefix(1);
     }
-    uint32_t wlen = (uint32_t)out.size();
-    memcpy(&conn->wbuf[0], &wlen, 4);
-    memcpy(&conn->wbuf[4], out.data(), out.size());
-    conn->wbuf_size = 4 + wlen;
-
-
-    size_t remain = conn->rbuf_size - 4 - len;
-    if (remain) {
-        memmove(conn->rbuf, &conn->rbuf[4 + len], remain);
+    if (s.size() > 1 && s[0] == '+' && s[1] != '-') {
+        s.remove_prefix(1);     // from_chars takes no "+"
     }
-    conn->rbuf_size = remain;
-
-    conn->state = STATE_RES;
-    state_res(conn);
-
+    return str2dbl(s, out.score);
+}
 
+// the members scored below `score`, or up to it if `inclusive`
+static uint64_t zcount_below(const ZSet *zset, double score, bool inclusive) {
+    if (inclusive && score == INFINITY) {
+        return zset->size();
+    }
+    if (inclusive) {
+        score = nextafter(score, INFINITY);
+    }
+    // "" is the least name, so this is the first with that score
+    return zset->rank(zset->seek(score, ""));
+}
 
+// the [begin, end) ranks of the members in [min, max]
+static void zscore_ranks(const ZSet *zset, const ScoreBound &min, const ScoreBound &max,
+    uint64_t &begin, uint64_t &end)
+{
+    begin = zcount_below(zset, min.score, min.excl);
+    end = zcount_below(zset, max.score, !max.excl);
+    end = std::max(begin, end);
+}
 
-    return (conn->state == STATE_REQ);
+// `n` members from `rank` on, or back if `rev`, with the scores
+// after the names if `withscores`
+static void out_zrange(RespWriter &out, const ZSet *zset, uint64_t rank, uint64_t n,
+    bool rev, bool withscores)
+{
+    out_arr(out, (uint32_t)(n * (withscores ? 2 : 1)));
+    ZIter it = zset->select(rank);
+    for (uint64_t i = 0; i < n; ++i) {
+        assert(it.valid());
+        out_str(out, it.name());
+        if (withscores) {
+            out_dbl(out, it.score());
+        }
+        zset->advance(it, rev ? -1 : +1);
+    }
 }
 
-static bool try_fill_buffer(Conn *conn) {
+// zcount key min max
+static void do_zcount(std::vector<std::string_view> &cmd, RespWriter &out) {
+    ScoreBound min, max;
+    if (!parse_bound(cmd[2], min) || !parse_bound(cmd[3], max)) {
+        return out_err(out, ERR_ARG, "expect fp number");
+    }
+    ZSet *zset = NULL;
+    if (!find_zset(out, cmd[1], &zset)) {
+        return;
+    }
+    if (!zset) {
+        return out_int(out, 0);
+    }
+    uint64_t begin = 0, end = 0;
+    zscore_ranks(zset, min, max, begin, end);
+    return out_int(out, (int64_t)(end - begin));
+}
+
+// zrange key start stop [withscores], zrevrange the same counting from
+// the highest. negative indexes count from the other end.
+static void zrange(std::vector<std::string_view> &cmd, RespWriter &out, bool rev) {
+    int64_t start = 0, stop = 0;
+    if (!str2int(cmd[2], start) || !str2int(cmd[3], stop)) {
+        return out_err(out, ERR_ARG, "expect int");
+    }
+    bool withscores = cmd.size() == 5 && cmd_is(cmd[4], "withscores");
+    if (cmd.size() > 5 || (cmd.size() == 5 && !withscores)) {
+        return out_err(out, ERR_ARG, "expect withscores");
+    }
+    ZSet *zset = NULL;
+    if (!find_zset(out, cmd[1], &zset)) {
+        return;
+    }
+    int64_t size = zset ? (int64_t)zset->size() : 0;
+    if (start < 0) {
+        start = std::max(start + size, (int64_t)0);
+    }
+    if (stop < 0) {
+        stop += size;
+    }
+    stop = std::min(stop, size - 1);
+    if (start > stop) {
+        return out_arr(out, 0);
+    }
+    uint64_t rank = (uint64_t)(rev ? size - 1 - start : start);
+    return out_zrange(out, zset, rank, (uint64_t)(stop - start + 1), rev, withscores);
+}
+
+static void do_zrange(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return zrange(cmd, out, false);
+}
+
+static void do_zrevrange(std::vector<std::string_view> &cmd, RespWriter &out) {
+    return zrange(cmd, out, true);
+}
+
+// zrangebyscore key min max [withscores] [limit offset count], a
+// negative count is all of them
+static void do_zrangebyscore(std::vector<std::string_view> &cmd, RespWriter &out) {
+    ScoreBound min, max;
+    if (!parse_bound(cmd[2], min) || !parse_bound(cmd[3], max)) {
+        return out_err(out, ERR_ARG, "expect fp number");
+    }
+    bool withscores = false;
+    int64_t offset = 0, count = -1;
+    for (size_t i = 4; i < cmd.size(); ++i) {
+        if (cmd_is(cmd[i], "withscores")) {
+            withscores = true;
+        } else if (cmd_is(cmd[i], "limit") && i + 2 < cmd.size()) {
+            if (!str2int(cmd[i + 1], offset) || !str2int(cmd[i + 2], count)) {
+                return out_err(out, ERR_ARG, "expect int");
+            }
+            i += 2;
+        } else {
+            return out_err(out, ERR_ARG, "expect withscores or limit");
+        }
+    }
+    ZSet *zset = NULL;
+    if (!find_zset(out, cmd[1], &zset)) {
+        return;
+    }
+    if (!zset || offset < 0) {
+        return out_arr(out, 0);
+    }
+    uint64_t begin = 0, end = 0;
+    zscore_ranks(zset, min, max, begin, end);
+    begin = std::min(begin + (uint64_t)offset, end);
+    if (count >= 0) {
+        end = std::min(end, begin + (uint64_t)count);
+    }
+    return out_zrange(out, zset, begin, end - begin, false, withscores);
+}
+
+// the end of the [...] class starting at pat[i], or npos if unclosed
+static size_t glob_class_end(std::string_view pat, size_t i) {
+    i++;
+    if (i < pat.size() && pat[i] == '^') {
+        i++;
+    }
+    for (bool first = true; i < pat.size(); ++i, first = false) {
+        if (pat[i] == '\\' && i + 1 < pat.size()) {
+            i++;
+        } else if (pat[i] == ']' && !first) {
+            return i;
+        }
+    }
+    return std::string_view::npos;
+}
+
+static bool glob_class_has(std::string_view cls, char c) {
+    bool neg = !cls.empty() && cls[0] == '^';
+    bool hit = false;
+    for (size_t i = neg ? 1 : 0; i < cls.size(); ++i) {
+        char lo = cls[i];
+        if (lo == '\\' && i + 1 < cls.size()) {
+            lo = cls[++i];
+        }
+        char hi = lo;
+        if (i + 2 < cls.size() && cls[i + 1] == '-') {
+            hi = cls[i + 2];
+            i += 2;
+        }
+        hit = hit || (lo <= c && c <= hi);
+    }
+    return hit != neg;
+}
 
+// glob match: * ? [abc] [a-z] [^a] and \ to escape. a `*` retries from
+// the last one only, so this is linear in practice.
+static bool glob_match(std::string_view pat, std::string_view str) {
+    size_t p = 0, s = 0;
+    size_t star = std::string_view::npos, star_s = 0;
+    while (s < str.size()) {
+        if (p < pat.size() && pat[p] == '*') {
+            star = p++;
+            star_s = s;
+            continue;
+        }
+        if (p < pat.size()) {
+            size_t next = p + 1;
+            bool ok = false;
+            if (pat[p] == '?') {
+                ok = true;
+            } else if (pat[p] == '[') {
+                size_t end = glob_class_end(pat, p);
+                if (end != std::string_view::npos) {
+                    ok = glob_class_has(pat.substr(p + 1, end - p - 1), str[s]);
+                    next = end + 1;
+                } else {
+                    ok = str[s] == '[';
+                }
+            } else if (pat[p] == '\\' && p + 1 < pat.size()) {
+                ok = str[s] == pat[p + 1];
+                next = p + 2;
+            } else {
+                ok = str[s] == pat[p];
+            }
+            if (ok) {
+                p = next;
+                s++;
+                continue;
+            }
+        }
+        if (star == std::string_view::npos) {
+            return false;
+        }
+        p = star + 1;
+        s = ++star_s;
+    }
+    while (p < pat.size() && pat[p] == '*') {
+        p++;
+    }
+    return p == pat.size();
+}
+
+// SCAN cursor [MATCH pattern] [COUNT n]. the cursor walks the shards in
+// turn: its remainder mod the shard count picks the shard, the quotient
+// is that shard's SwissMap::scan() position. replies [next cursor, keys].
+static void do_scan(std::vector<std::string_view> &cmd, RespWriter &out) {
+    int64_t cursor = 0;
+    if (!str2int(cmd[1], cursor) || cursor < 0) {
+        return out_err(out, ERR_ARG, "invalid cursor");
+    }
+    std::string_view pattern;
+    bool match = false;
+    int64_t count = 10;
+    for (size_t i = 2; i < cmd.size(); i += 2) {
+        if (i + 1 == cmd.size()) {
+            return out_err(out, ERR_ARG, "syntax error");
+        }
+        if (cmd_is(cmd[i], "match")) {
+            pattern = cmd[i + 1];
+            match = !(pattern.size() == 1 && pattern[0] == '*');
+        } else if (cmd_is(cmd[i], "count")) {
+            if (!str2int(cmd[i + 1], count) || count <= 0) {
+                return out_err(out, ERR_ARG, "expect positive int");
+            }
+        } else {
+            return out_err(out, ERR_ARG, "syntax error");
+        }
+    }
+
+    uint64_t nshards = g_shards.size();
+    uint64_t shard = (uint64_t)cursor % nshards;
+    uint64_t pos = (uint64_t)cursor / nshards;
+    assert(shard == g_data->id);
+
+    out_arr(out, 2);
+    uint8_t *next = out_reserve(out, SER_INT, 8);
+    uint8_t *arr = begin_arr(out);
+    uint32_t n = 0;
+    // COUNT is keys looked at, not returned, so a MATCH that rarely hits
+    // can't turn one call into a walk of the whole keyspace. bounded
+    // in positions too, for a table that is mostly empty. saturated, as
+    // COUNT can be any positive int64.
+    int64_t seen = 0;
+    int64_t positions = count > INT64_MAX / 10 ? INT64_MAX : count * 10;
+    do {
+        pos = g_data->db.scan(pos, [&](Entry *ent) {
+            seen++;
+            std::string_view key = entry_key(ent);
+            if (!match || glob_match(pattern, key)) {
+                out_str(out, key);
+                n++;
+            }
+        });
+    } while (pos != 0 && seen < count && --positions > 0);
+    end_arr(out, arr, n);
+
+    int64_t rv = 0;
+    if (pos != 0) {
+        rv = (int64_t)(pos * nshards + shard);
+    } else if (shard + 1 < nshards) {
+        rv = (int64_t)(shard + 1);  // position 0 of the next shard
+    }
+    memcpy(next, &rv, 8);
+}
+
+static void do_cmdstats(std::vector<std::string_view> &cmd, RespWriter &out);
+static void do_dbstats(std::vector<std::string_view> &cmd, RespWriter &out);
+static void do_memused(std::vector<std::string_view> &cmd, RespWriter &out);
+static void do_slabstats(std::vector<std::string_view> &cmd, RespWriter &out);
+
+enum {
+    CMD_READ = 1,
+    CMD_WRITE = 2,
+    CMD_ALL_SHARDS = 4,     // every shard replies an array, they are merged
+    CMD_CURSOR = 8,         // routed by the shard in the cursor, cmd[1]
+};
+
+struct Command {
+    const char *name;
+    void (*handler)(std::vector<std::string_view> &cmd, RespWriter &out);
+    int32_t arity;      // counting the name, -n for at least n
+    uint32_t flags;
+    // which arguments are keys: first, last (-1 is the last argument),
+    // step. 0 when the command has none.
+    int32_t first_key;
+    int32_t last_key;
+    int32_t key_step;
+};
+
+static const Command g_cmds[] = {
+    {"scan",     &do_scan,    -2, CMD_READ | CMD_CURSOR, 0, 0, 0},
+    {"get",      &do_get,      2, CMD_READ,  1, 1, 1},
+    {"set",      &do_set,      3, CMD_WRITE, 1, 1, 1},
+    {"del",      &do_del,      2, CMD_WRITE, 1, 1, 1},
+    {"incr",     &do_incr,     2, CMD_WRITE, 1, 1, 1},
+    {"decr",     &do_decr,     2, CMD_WRITE, 1, 1, 1},
+    {"incrby",   &do_incrby,   3, CMD_WRITE, 1, 1, 1},
+    {"decrby",   &do_decrby,   3, CMD_WRITE, 1, 1, 1},
+    {"incrbyfloat", &do_incrbyfloat, 3, CMD_WRITE, 1, 1, 1},
+    {"pexpire",  &do_expire,   3, CMD_WRITE, 1, 1, 1},
+    {"pttl",     &do_ttl,      2, CMD_READ,  1, 1, 1},
+    {"zadd",     &do_zadd,    -4, CMD_WRITE, 1, 1, 1},
+    {"zrem",     &do_zrem,     3, CMD_WRITE, 1, 1, 1},
+    {"zscore",   &do_zscore,   3, CMD_READ,  1, 1, 1},
+    {"zquery",   &do_zquery,   6, CMD_READ,  1, 1, 1},
+    {"zindex",   &do_zindex,  -2, CMD_WRITE, 1, 1, 1},
+    {"zrank",    &do_zrank,    3, CMD_READ,  1, 1, 1},
+    {"zrevrank", &do_zrevrank, 3, CMD_READ,  1, 1, 1},
+    {"zcount",   &do_zcount,   4, CMD_READ,  1, 1, 1},
+    {"zrange",   &do_zrange,  -4, CMD_READ,  1, 1, 1},
+    {"zrevrange", &do_zrevrange, -4, CMD_READ, 1, 1, 1},
+    {"zrangebyscore", &do_zrangebyscore, -4, CMD_READ, 1, 1, 1},
+    {"cmdstats", &do_cmdstats, 1, CMD_READ,  0, 0, 0},
+    {"dbstats",  &do_dbstats,  1, CMD_READ | CMD_ALL_SHARDS, 0, 0, 0},
+    {"memused",  &do_memused,  1, CMD_READ, 0, 0, 0},
+    {"slabstats", &do_slabstats, 1, CMD_READ | CMD_ALL_SHARDS, 0, 0, 0},
+};
+
+const size_t k_ncmds = sizeof(g_cmds) / sizeof(g_cmds[0]);
+
+// names are found by open addressing on length, first and last byte,
+// which tells all of g_cmds apart without reading the whole name
+const size_t k_cmd_slots = 64;
+static uint8_t g_cmd_index[k_cmd_slots];    // g_cmds index + 1, 0 is empty
+
+static size_t cmd_slot(std::string_view name) {
+    size_t h = name.size();
+    h = h * 31 + (uint8_t)(name.front() | 0x20);
+    h = h * 31 + (uint8_t)(name.back() | 0x20);
+    return h & (k_cmd_slots - 1);
+}
+
+static void cmd_init() {
+    static_assert(k_ncmds < k_cmd_slots, "grow k_cmd_slots");
+    for (size_t i = 0; i < k_ncmds; ++i) {
+        size_t pos = cmd_slot(g_cmds[i].name);
+        while (g_cmd_index[pos]) {
+            pos = (pos + 1) & (k_cmd_slots - 1);
+        }
+        g_cmd_index[pos] = (uint8_t)(i + 1);
+    }
+}
+
+// NULL for an unknown command
+static const Command *cmd_lookup(std::vector<std::string_view> &cmd) {
+    if (cmd.empty() || cmd[0].empty()) {
+        return NULL;
+    }
+    size_t pos = cmd_slot(cmd[0]);
+    while (g_cmd_index[pos]) {
+        const Command *c = &g_cmds[g_cmd_index[pos] - 1];
+        if (cmd_is(cmd[0], c->name)) {
+            return c;
+        }
+        pos = (pos + 1) & (k_cmd_slots - 1);
+    }
+    return NULL;
+}
 
-    assert(conn->rbuf_size < sizeof(conn->rbuf));
+static bool cmd_arity_ok(const Command *c, size_t n) {
+    return c->arity >= 0 ? n == (size_t)c->arity : n >= (size_t)-c->arity;
+}
+
+static void cmd_count(const Command *c) {
+    // single writer, a plain increment that other shards may read
+    std::atomic<uint64_t> &n = g_data->calls[c - g_cmds];
+    n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void do_cmdstats(std::vector<std::string_view> &cmd, RespWriter &out) {
+    (void)cmd;
+    out_arr(out, (uint32_t)(k_ncmds * 2));
+    for (size_t i = 0; i < k_ncmds; ++i) {
+        uint64_t calls = 0;
+        for (Shard *shard : g_shards) {
+            calls += shard->calls[i].load(std::memory_order_relaxed);
+        }
+        out_str(out, g_cmds[i].name, strlen(g_cmds[i].name));
+        out_int(out, (int64_t)calls);
+    }
+}
+
+// per shard: id, keys, slots allocated, load factor. slots include the
+// old table while a resize is moving keys out of it.
+static void do_dbstats(std::vector<std::string_view> &cmd, RespWriter &out) {
+    (void)cmd;
+    out_arr(out, 4);
+    out_int(out, g_data->id);
+    out_int(out, (int64_t)g_data->db.size());
+    out_int(out, (int64_t)g_data->db.capacity());
+    out_dbl(out, g_data->db.loadFactor());
+}
+
+// heap bytes in use by the whole process, what a key costs is the
+// difference before and after adding many
+static void do_memused(std::vector<std::string_view> &cmd, RespWriter &out) {
+    (void)cmd;
+    struct mallinfo2 mi = mallinfo2();
+    out_int(out, (int64_t)(mi.uordblks + mi.hblkhd));
+}
+
+// per shard: id, slab pages, objects and bytes handed out, objects
+// freed by the thread pool
+static void do_slabstats(std::vector<std::string_view> &cmd, RespWriter &out) {
+    (void)cmd;
+    SlabStats st = slab_stats();
+    out_arr(out, 5);
+    out_int(out, g_data->id);
+    out_int(out, (int64_t)st.pages);
+    out_int(out, (int64_t)st.objects);
+    out_int(out, (int64_t)st.bytes);
+    out_int(out, (int64_t)st.remote_frees);
+}
+
+static void do_request(
+    const Command *c, std::vector<std::string_view> &cmd, RespWriter &out)
+{
+    if (!c) {
+        return out_err(out, ERR_UNKNOWN, "Unknown cmd");
+    }
+    if (!cmd_arity_ok(c, cmd.size())) {
+        return out_err(out, ERR_ARG, "wrong number of arguments");
+    }
+    c->handler(cmd, out);
+}
+
+// queue a reply built elsewhere, e.g. by another shard
+static void conn_push_res(Conn *conn, ChainBuf *res) {
+    RespWriter out;
+    out_begin(out, &conn->out);
+    chain_splice(&conn->out, res);
+    out_end(out);
+}
+
+static uint32_t shard_of(std::string_view key) {
+    uint64_t h = str_hash((const uint8_t *)key.data(), key.size());
+    // h % n would hand each shard keys that share their low hash bits,
+    // which the shard's own tables then index by; use other bits
+    return (uint32_t)(((h * 0x9E3779B97F4A7C15ull) >> 32) % g_shards.size());
+}
+
+// a request or, once `src` gets it back, the reply to it
+struct ShardMsg {
+    Conn *conn = NULL;
+    uint32_t src = 0;
+    const Command *c = NULL;
+    std::vector<std::string> cmd;   // copied, `conn` reads on meanwhile
+    ChainBuf out;   // unframed reply
+};
+
+// the parts of a CMD_ALL_SHARDS reply, merged into one array
+struct Gather {
+    ChainBuf items;
+    uint32_t n = 0;
+};
+
+static void shard_send(uint32_t dst, ShardMsg *m) {
+    SPSCQueue *q = &g_queues[g_data->id * g_shards.size() + dst];
+    std::deque<ShardMsg *> &backlog = g_data->outbox[dst];
+    if (!backlog.empty() || !spsc_push(q, m)) {
+        backlog.push_back(m);
+    }
+    g_data->dirty[dst] = 1;
+}
+
+// append one shard's part of a CMD_ALL_SHARDS reply to the merged array
+static void shard_gather(Conn *conn, ChainBuf *part) {
+    // a part starts its own chain, so the array header is contiguous
+    Segment *seg = part->head;
+    assert(seg && seg->data[seg->start] == SER_ARR);
+    uint32_t n = 0;
+    memcpy(&n, &seg->data[seg->start + 1], 4);
+    conn->gather->n += n;
+    chain_consume(part, 5);
+    chain_splice(&conn->gather->items, part);
+    conn->waiting--;
+}
+
+static void conn_park(Conn *conn) {
+    // no I/O and no idle timeout until the reply is back
+    conn->state = STATE_WAIT;
+    dlist_detach(&conn->idle_list);
+    dlist_init(&conn->idle_list);
+}
+
+// hand the command to the shard owning its key. returns false if it is
+// served here, otherwise the connection waits in STATE_WAIT.
+static bool shard_forward(
+    Conn *conn, const Command *c, std::vector<std::string_view> &cmd)
+{
+    if (!c || !cmd_arity_ok(c, cmd.size())) {
+        return false;   // the error is replied here
+    }
+    uint32_t nshards = (uint32_t)g_shards.size();
+    if (c->flags & CMD_ALL_SHARDS) {
+        conn->gather = new Gather();
+        conn->waiting = nshards;
+        for (uint32_t i = 0; i < nshards; ++i) {
+            if (i == g_data->id) {
+                continue;
+            }
+            ShardMsg *m = new ShardMsg();
+            m->conn = conn;
+            m->src = g_data->id;
+            m->c = c;
+            m->cmd.assign(cmd.begin(), cmd.end());
+            shard_send(i, m);
+        }
+        ChainBuf part;
+        RespWriter out;
+        out_init(out, &part);
+        do_request(c, cmd, out);
+        shard_gather(conn, &part);
+        conn_park(conn);
+        return true;
+    }
+    uint32_t dst = 0;
+    int64_t cursor = 0;
+    if (c->flags & CMD_CURSOR) {
+        if (!str2int(cmd[1], cursor) || cursor < 0) {
+            return false;   // the handler replies the error
+        }
+        dst = (uint32_t)((uint64_t)cursor % nshards);
+    } else if (c->first_key > 0) {
+        dst = shard_of(cmd[c->first_key]);
+    } else {
+        return false;
+    }
+    if (dst == g_data->id) {
+        return false;
+    }
+    ShardMsg *m = new ShardMsg();
+    m->conn = conn;
+    m->src = g_data->id;
+    m->c = c;
+    m->cmd.assign(cmd.begin(), cmd.end());
+    shard_send(dst, m);
+    conn->waiting = 1;
+    conn_park(conn);
+    return true;
+}
+
+static bool try_one_request(Conn *conn) {
+
+    if (conn->in.size < 4) {
+        return false;
+    }
+
+
+    const uint8_t *req = inbuf_head(&conn->in);
+    uint32_t len = 0;
+    memcpy(&len, req, 4);
+    if (len > g_max_msg) {
+        msg("too long");
+        conn->state = STATE_END;
+        return false;
+    }
+    if (4 + (size_t)len > conn->in.size) {
+
+        return false;
+    }
+
+
+    std::vector<std::string_view> &cmd = conn->args;
+    if (0 != parse_req(&req[4], len, cmd)) {
+        msg("bad req");
+        conn->state = STATE_END;
+        return false;
+    }
+
+
+    // only moves the cursor, `cmd` stays valid until the next read
+    inbuf_consume(&conn->in, 4 + (size_t)len);
+
+    const Command *c = cmd_lookup(cmd);
+    if (c) {
+        cmd_count(c);
+    }
+    if (g_shards.size() > 1 && shard_forward(conn, c, cmd)) {
+        return false;
+    }
+
+    // the response is only queued, see state_req()
+    RespWriter out;
+    out_begin(out, &conn->out);
+    do_request(c, cmd, out);
+    out_end(out);
+    return conn->out.size < k_max_outq;
+}
+
+// room for the rest of a partially received request
+static void conn_reserve_in(Conn *conn) {
+    size_t want = 1;
+    if (conn->in.size >= 4) {
+        uint32_t len = 0;
+        memcpy(&len, inbuf_head(&conn->in), 4);
+        if (len <= g_max_msg && 4 + (size_t)len > conn->in.size) {
+            want = 4 + (size_t)len - conn->in.size;
+        }
+    }
+    inbuf_reserve(&conn->in, want);
+}
+
+// returns true if the read filled the buffer, i.e. the socket may have
+// more. a short read means it is drained: edge-triggered epoll reports
+// anything arriving after it, so no extra read() to see EAGAIN.
+static bool try_fill_buffer(Conn *conn) {
+
+
+    conn_reserve_in(conn);
+    size_t cap = inbuf_room(&conn->in);
     ssize_t rv = 0;
     do {
-        size_t cap = sizeof(conn->rbuf) - conn->rbuf_size;
-        rv = read(conn->fd, &conn->rbuf[conn->rbuf_size], cap);
+        rv = read(conn->fd, inbuf_tail(&conn->in), cap);
     } while (rv < 0 && errno == EINTR);
     if (rv < 0 && errno == EAGAIN) {
 
@@ -695,7 +1737,7 @@ static bool try_fill_buffer(Conn *conn) {
         return false;
     }
     if (rv == 0) {
-        if (conn->rbuf_size > 0) {
+        if (conn->in.size > 0) {
             msg("unexpected EOF");
         } else {
             msg("EOF");
@@ -704,24 +1746,53 @@ static bool try_fill_buffer(Conn *conn) {
         return false;
     }
 
-    conn->rbuf_size += (size_t)rv;
-    assert(conn->rbuf_size <= sizeof(conn->rbuf));
-
-
-
-    while (try_one_request(conn)) {}
-    return (conn->state == STATE_REQ);
+    conn->in.size += (size_t)rv;
+    return (size_t)rv == cap;
 }
 
+// serve every complete request in the input buffer, reading more while
+// the socket has it, then write all the queued responses with one writev().
 static void state_req(Conn *conn) {
-    while (try_fill_buffer(conn)) {}
+    bool drained = false;
+    bool eof_read = false;
+    while (conn->state == STATE_REQ) {
+        while (try_one_request(conn)) {}
+        if (conn->state != STATE_REQ) {
+            break;      // STATE_END, or STATE_WAIT on another shard
+        }
+        // past the peer's FIN the next read is the EOF, which ends the
+        // connection, so the replies go out before it
+        if (drained || conn->out.size >= k_max_outq
+            || (conn->rdhup && conn->out.size > 0))
+        {
+            if (conn->out.size == 0) {
+                if (!conn->rdhup || eof_read) {
+                    break;
+                }
+                // a FIN that came with the last data spent its edge with
+                // it, so read once more, to the EOF, after the replies
+                eof_read = true;
+                drained = false;
+                continue;
+            }
+            // back in STATE_REQ if everything went out, then go on with
+            // whatever the queue limit left unserved
+            conn->state = STATE_RES;
+            state_res(conn);
+            continue;
+        }
+        drained = !try_fill_buffer(conn);
+    }
+    // hand the segment back while the connection is idle
+    inbuf_shrink(&conn->in);
 }
 
 static bool try_flush_buffer(Conn *conn) {
+    struct iovec iov[k_max_iov];
+    int n = chain_iov(&conn->out, iov, k_max_iov);
     ssize_t rv = 0;
     do {
-        size_t remain = conn->wbuf_size - conn->wbuf_sent;
-        rv = write(conn->fd, &conn->wbuf[conn->wbuf_sent], remain);
+        rv = writev(conn->fd, iov, n);
     } while (rv < 0 && errno == EINTR);
     if (rv < 0 && errno == EAGAIN) {
                 return false;
@@ -731,14 +1802,11 @@ static bool try_flush_buffer(Conn *conn) {
         conn->state = STATE_END;
         return false;
     }
-    conn->wbuf_sent += (size_t)rv;
-    assert(conn->wbuf_sent <= conn->wbuf_size);
-    if (conn->wbuf_sent == conn->wbuf_size) {
+    chain_consume(&conn->out, (size_t)rv);
+    if (conn->out.size == 0) {
 
 
         conn->state = STATE_REQ;
-        conn->wbuf_sent = 0;
-        conn->wbuf_size = 0;
         return false;
     }
 
@@ -749,22 +1817,25 @@ static void state_res(Conn *conn) {
     while (try_flush_buffer(conn)) {}
 }
 
-static void connection_io(Conn *conn) {
-   
-
-
+static void conn_touch(Conn *conn) {
     conn->idle_start = get_monotonic_usec();
     dlist_detach(&conn->idle_list);
-    dlist_insert_before(&g_data.idle_list, &conn->idle_list);
+    dlist_insert_before(&g_data->idle_list, &conn->idle_list);
+}
+
+static void connection_io(Conn *conn) {
+    if (conn->state == STATE_WAIT) {
+        // the socket is drained by state_req() once the reply is back
+        return;
+    }
+    conn_touch(conn);
+    assert(conn->state == STATE_REQ || conn->state == STATE_RES);
+    if (conn->state == STATE_RES) {
+        state_res(conn);
+    }
     if (conn->state == STATE_REQ) {
+        // keep reading until EAGAIN, no further edge will be reported
         state_req(conn);
-    } else if (conn->state == STATE_RES) {
-        state_res(conn);
-    } else {
-        assert(0);
-
-
-        
     }
 }
 
@@ -776,15 +1847,15 @@ static uint32_t next_timer_ms() {
 
 
 
-    if (!dlist_empty(&g_data.idle_list)) {
-        Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
+    if (!dlist_empty(&g_data->idle_list)) {
+        Conn *next = container_of(g_data->idle_list.next, Conn, idle_list);
         next_us = next->idle_start + k_idle_timeout_ms * 1000;
     }
 
 
 
-    if (!g_data.heap.empty() && g_data.heap[0].val < next_us) {
-        next_us = g_data.heap[0].val;
+    if (!g_data->heap.empty() && g_data->heap[0].val < next_us) {
+        next_us = g_data->heap[0].val;
     }
 
     if (next_us == (uint64_t)-1) {
@@ -800,15 +1871,55 @@ static uint32_t next_timer_ms() {
     return (uint32_t)((next_us - now_us) / 1000);
 }
 
-static void conn_done(Conn *conn) {
-    g_data.fd2conn[conn->fd] = NULL;
+#ifdef USE_URING
+static void conn_release_buf(Conn *conn);
+#endif
+
+static void conn_free(Conn *conn) {
+#ifdef USE_URING
+    conn_release_buf(conn);
+#endif
+    inbuf_free(&conn->in);
+    chain_clear(&conn->out);
+    if (g_data->epfd >= 0) {
+        (void)epoll_ctl(g_data->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    }
     (void)close(conn->fd);
-    dlist_detach(&conn->idle_list);
-    free(conn);
+    if (g_data->conn_pool.size() >= k_conn_pool_max) {
+        delete conn;
+        return;
+    }
+    // back to a fresh state, keeping the vectors' capacity
+    conn->fd = -1;
+    conn->state = STATE_REQ;
+    conn->idle_start = 0;
+    conn->events = 0;
+    conn->rdhup = false;
+    conn->waiting = 0;
+    conn->gather = NULL;
+#ifdef USE_URING
+    conn->inflight = 0;
+    conn->closed = false;
+    conn->in_bid = -1;
+    conn->in_off = 0;
+    conn->in_len = 0;
+#endif
+    g_data->conn_pool.push_back(conn);
 }
 
-static bool hnode_same(HNode *lhs, HNode *rhs) {
-    return lhs == rhs;
+static void conn_done(Conn *conn) {
+    g_data->fd2conn[conn->fd] = NULL;
+    dlist_detach(&conn->idle_list);
+#ifdef USE_URING
+    if (conn->inflight) {
+        // the kernel still owns an SQE for it, the last completion frees it
+        conn->closed = true;
+        conn->state = STATE_END;
+        (void)shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+#endif
+    conn_free(conn);
 }
 
 static void process_timers() {
@@ -817,8 +1928,8 @@ static void process_timers() {
 
 
 
-    while (!dlist_empty(&g_data.idle_list)) {
-        Conn *next = container_of(g_data.idle_list.next, Conn, idle_list);
+    while (!dlist_empty(&g_data->idle_list)) {
+        Conn *next = container_of(g_data->idle_list.next, Conn, idle_list);
         uint64_t next_us = next->idle_start + k_idle_timeout_ms * 1000;
         if (next_us >= now_us) {
 
@@ -833,10 +1944,9 @@ static void process_timers() {
 
     const size_t k_max_works = 2000;
     size_t nworks = 0;
-    while (!g_data.heap.empty() && g_data.heap[0].val < now_us) {
-        Entry *ent = container_of(g_data.heap[0].ref, Entry, heap_idx);
-        HNode *node = hm_pop(&g_data.db, &ent->node, &hnode_same);
-        assert(node == &ent->node);
+    while (!g_data->heap.empty() && g_data->heap[0].val < now_us) {
+        Entry *ent = entry_of_heap_idx(g_data->heap[0].ref);
+        g_data->db.remove(ent);
         entry_del(ent);
         if (nworks++ >= k_max_works) {
 
@@ -844,94 +1954,549 @@ static void process_timers() {
             break;
         }
     }
+
+    // keys deleted on the thread pool give their memory back here
+    slab_collect();
 }
 
-int main() {
+#ifdef USE_URING
+static void uring_conn_io(Conn *conn);
+#endif
 
+// a reply from another shard, resume the parked connection
+static void shard_on_reply(ShardMsg *m) {
+    Conn *conn = m->conn;
+    if (conn->gather) {
+        shard_gather(conn, &m->out);
+    } else {
+        conn_push_res(conn, &m->out);
+        conn->waiting = 0;
+    }
+    delete m;
+    if (conn->waiting) {
+        return;
+    }
+    if (conn->gather) {
+        RespWriter out;
+        out_begin(out, &conn->out);
+        out_arr(out, conn->gather->n);
+        chain_splice(&conn->out, &conn->gather->items);
+        out_end(out);
+        delete conn->gather;
+        conn->gather = NULL;
+    }
 
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) {
-        die("socket()");
+    // carry on with the rest of the pipeline
+    conn->state = STATE_REQ;
+    conn_touch(conn);
+#ifdef USE_URING
+    if (g_data->uring) {
+        uring_conn_io(conn);
+        if (conn->state == STATE_END) {
+            conn_done(conn);
+        }
+        return;
+    }
+#endif
+    state_req(conn);
+    if (conn->state == STATE_END) {
+        conn_done(conn);
+    } else {
+        conn_update_events(conn);
     }
+}
 
-    int val = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+// serve requests forwarded to us and take in replies to ours
+static void shard_poll() {
+    uint32_t nshards = (uint32_t)g_shards.size();
+    for (uint32_t src = 0; src < nshards; ++src) {
+        if (src == g_data->id) {
+            continue;
+        }
+        SPSCQueue *q = &g_queues[src * nshards + g_data->id];
+        void *item = NULL;
+        while ((item = spsc_pop(q))) {
+            ShardMsg *m = (ShardMsg *)item;
+            if (m->src == g_data->id) {
+                shard_on_reply(m);
+            } else {
+                std::vector<std::string_view> cmd(m->cmd.begin(), m->cmd.end());
+                RespWriter out;
+                out_init(out, &m->out);
+                do_request(m->c, cmd, out);
+                shard_send(m->src, m);
+            }
+        }
+    }
+}
 
+// push what didn't fit into the queues and wake the targets once per
+// loop iteration. returns true if something is still backlogged.
+static bool shard_flush() {
+    bool backlog = false;
+    for (uint32_t dst = 0; dst < g_shards.size(); ++dst) {
+        if (!g_data->dirty[dst]) {
+            continue;
+        }
+        SPSCQueue *q = &g_queues[g_data->id * g_shards.size() + dst];
+        std::deque<ShardMsg *> &pending = g_data->outbox[dst];
+        while (!pending.empty() && spsc_push(q, pending.front())) {
+            pending.pop_front();
+        }
+        uint64_t one = 1;
+        (void)!write(g_shards[dst]->wake_fd, &one, sizeof(one));
+        if (pending.empty()) {
+            g_data->dirty[dst] = 0;
+        } else {
+            backlog = true;
+        }
+    }
+    return backlog;
+}
 
-    struct sockaddr_in addr = {};
-    addr.sin_family = AF_INET;
-    addr.sin_port = ntohs(1234);
-    addr.sin_addr.s_addr = ntohl(0);   
-    int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
-    if (rv) {
+#ifdef USE_URING
+enum {
+    OP_ACCEPT = 0,
+    OP_RECV = 1,
+    OP_SEND = 2,
+    OP_WAKE = 3,
+};
 
-        die("bind()");
+const uint64_t k_op_mask = 3;   // user_data = Conn pointer | OP_*
+const uint16_t k_uring_bgid = 0;
+const uint32_t k_uring_nbufs = 1024;
+const uint32_t k_uring_buf_size = 4096;
+
+static io_uring_sqe *uring_sqe() {
+    io_uring_sqe *sqe = uring_get_sqe(&g_data->ring);
+    while (!sqe) {
+        // the submission queue is full, hand it to the kernel first
+        (void)uring_submit_and_wait(&g_data->ring, 0, 0);
+        sqe = uring_get_sqe(&g_data->ring);
+    }
+    return sqe;
+}
+
+static void uring_arm_accept(int fd) {
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->user_data = OP_ACCEPT;
+}
+
+static void uring_arm_wake() {
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = g_data->wake_fd;
+    sqe->addr = (uint64_t)&g_data->wake_buf;
+    sqe->len = sizeof(g_data->wake_buf);
+    sqe->user_data = OP_WAKE;
+}
+
+static void uring_arm_recv(Conn *conn) {
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->len = k_uring_buf_size;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = k_uring_bgid;
+    sqe->user_data = (uint64_t)conn | OP_RECV;
+    conn->inflight++;
+}
+
+// all queued responses go out in one SENDMSG
+static void uring_arm_send(Conn *conn) {
+    conn->iov.resize(k_max_iov);
+    int n = chain_iov(&conn->out, conn->iov.data(), (int)conn->iov.size());
+    memset(&conn->mh, 0, sizeof(conn->mh));
+    conn->mh.msg_iov = conn->iov.data();
+    conn->mh.msg_iovlen = n;
+
+    io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)&conn->mh;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uint64_t)conn | OP_SEND;
+    conn->inflight++;
+}
 
+static void conn_release_buf(Conn *conn) {
+    if (conn->in_bid >= 0) {
+        uring_buf_recycle(&g_data->bufs, (uint16_t)conn->in_bid);
+        conn->in_bid = -1;
     }
+}
 
+// the completion counterpart of state_req(): `in` is fed from the
+// provided buffer of the last recv, and a new recv is only armed once
+// that buffer is used up. nothing is read while in STATE_RES.
+static void uring_conn_io(Conn *conn) {
+    while (conn->state == STATE_REQ) {
+        while (try_one_request(conn)) {}
+        if (conn->state != STATE_REQ) {
+            break;
+        }
+        if (conn->in_bid < 0 || conn->out.size >= k_max_outq) {
+            // responses to everything received so far go out together
+            if (conn->out.size > 0) {
+                conn->state = STATE_RES;
+                break;
+            }
+            inbuf_shrink(&conn->in);
+            uring_arm_recv(conn);
+            return;
+        }
+        conn_reserve_in(conn);
+        size_t cap = inbuf_room(&conn->in);
+        size_t n = cap < conn->in_len ? cap : conn->in_len;
+        uint8_t *buf = uring_buf_addr(&g_data->bufs, (uint16_t)conn->in_bid);
+        memcpy(inbuf_tail(&conn->in), &buf[conn->in_off], n);
+        conn->in.size += n;
+        conn->in_off += (uint32_t)n;
+        conn->in_len -= (uint32_t)n;
+        if (conn->in_len == 0) {
+            conn_release_buf(conn);
+        }
+    }
+    if (conn->state == STATE_RES) {
+        uring_arm_send(conn);
+    }
+}
 
-    rv = listen(fd, SOMAXCONN);
-    if (rv) {
-        die("listen()");
+static void uring_on_recv(Conn *conn, int32_t res, uint32_t flags) {
+    if (res == -ENOBUFS) {
+        // every buffer is held by some connection, retry next round;
+        // the pending retry still counts as in flight
+        g_data->nobufs.push_back(conn);
+        return;
+    }
+    conn->inflight--;
+    if (flags & IORING_CQE_F_BUFFER) {
+        conn->in_bid = (int32_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+        conn->in_off = 0;
+        conn->in_len = res > 0 ? (uint32_t)res : 0;
     }
+    if (conn->closed) {
+        return;
+    }
+    if (res <= 0) {
+        if (res < 0) {
+            msg("recv() error");
+        } else {
+            msg(conn->in.size > 0 ? "unexpected EOF" : "EOF");
+        }
+        conn->state = STATE_END;
+        return;
+    }
+    conn_touch(conn);
+    uring_conn_io(conn);
+}
 
+static void uring_on_send(Conn *conn, int32_t res) {
+    conn->inflight--;
+    if (conn->closed) {
+        return;
+    }
+    if (res < 0) {
+        msg("send() error");
+        conn->state = STATE_END;
+        return;
+    }
+    conn_touch(conn);
+    chain_consume(&conn->out, (size_t)res);
+    if (conn->out.size > 0) {
+        uring_arm_send(conn);
+        return;
+    }
+    conn->state = STATE_REQ;
+    uring_conn_io(conn);
+}
 
-    fd_set_nb(fd);
+// one io_uring_enter() per iteration submits the accept/recv/send SQEs
+// of every connection and reaps all completions.
+static void uring_loop(int fd) {
+    uring_arm_accept(fd);
+    uring_arm_wake();
+    bool backlog = false;
+    while (true) {
+        std::vector<Conn *> retry;
+        retry.swap(g_data->nobufs);
+        for (Conn *conn : retry) {
+            if (conn->closed) {
+                if (--conn->inflight == 0) {
+                    conn_free(conn);
+                }
+            } else {
+                conn->inflight--;
+                uring_arm_recv(conn);
+            }
+        }
 
+        int timeout_ms = (retry.empty() && !backlog) ? (int)next_timer_ms() : 0;
+        int rv = uring_submit_and_wait(&g_data->ring, 1, timeout_ms);
+        if (rv < 0 && rv != -ETIME && rv != -EINTR && rv != -EBUSY) {
+            errno = -rv;
+            die("io_uring_enter");
+        }
 
-    dlist_init(&g_data.idle_list);
-    thread_pool_init(&g_data.tp, 4);
+        io_uring_cqe *cqe = NULL;
+        while ((cqe = uring_peek_cqe(&g_data->ring))) {
+            uint64_t data = cqe->user_data;
+            int32_t res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_cqe_seen(&g_data->ring);
+
+            Conn *conn = (Conn *)(data & ~k_op_mask);
+            switch (data & k_op_mask) {
+            case OP_ACCEPT:
+                if (res >= 0) {
+                    conn = conn_new(res);
+                    if (conn) {
+                        uring_conn_io(conn);
+                    }
+                } else {
+                    msg("accept() error");
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    uring_arm_accept(fd);
+                }
+                continue;
+            case OP_WAKE:
+                uring_arm_wake();
+                continue;
+            case OP_RECV:
+                uring_on_recv(conn, res, flags);
+                break;
+            case OP_SEND:
+                uring_on_send(conn, res);
+                break;
+            }
+            if (conn->closed) {
+                if (conn->inflight == 0) {
+                    conn_free(conn);
+                }
+            } else if (conn->state == STATE_END) {
+                conn_done(conn);
+            }
+        }
 
+        shard_poll();
+        process_timers();
+        backlog = shard_flush();
+    }
+}
+#endif
 
-    std::vector<struct pollfd> poll_args;
-    while (true) {
+static void epoll_loop(int fd) {
+    g_data->epfd = epoll_create1(0);
+    if (g_data->epfd < 0) {
+        die("epoll_create1()");
+    }
+    struct epoll_event lev = {};
+    lev.events = EPOLLIN | EPOLLET;
+    lev.data.fd = fd;
+    if (epoll_ctl(g_data->epfd, EPOLL_CTL_ADD, fd, &lev)) {
+        die("epoll_ctl(ADD)");
+    }
+    lev.data.fd = g_data->wake_fd;
+    if (epoll_ctl(g_data->epfd, EPOLL_CTL_ADD, g_data->wake_fd, &lev)) {
+        die("epoll_ctl(ADD)");
+    }
 
-        poll_args.clear();
 
+    const int k_max_events = 1024;
+    std::vector<struct epoll_event> events(k_max_events);
+    bool backlog = false;
+    bool accept_more = false;   // the listener has no new edge coming
+    while (true) {
 
-        struct pollfd pfd = {fd, POLLIN, 0};
-        poll_args.push_back(pfd);
 
 
-        for (Conn *conn : g_data.fd2conn) {
-            if (!conn) {
+        int timeout_ms = backlog || accept_more ? 0 : (int)next_timer_ms();
+        int rv = epoll_wait(g_data->epfd, events.data(), k_max_events, timeout_ms);
+        if (rv < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            struct pollfd pfd = {};
-            pfd.fd = conn->fd;
-            pfd.events = (conn->state == STATE_REQ) ? POLLIN : POLLOUT;
-            pfd.events = pfd.events | POLLERR;
-            poll_args.push_back(pfd);
+            die("epoll_wait");
         }
 
 
 
-        int timeout_ms = (int)next_timer_ms();
-        int rv = poll(poll_args.data(), (nfds_t)poll_args.size(), timeout_ms);
-        if (rv < 0) {
-            die("poll");
+        for (int i = 0; i < rv; ++i) {
+            if (events[i].data.fd == fd) {
+                accept_more = true;
+            }
+        }
+        if (accept_more) {
+            accept_more = accept_burst(fd);
         }
 
+        for (int i = 0; i < rv; ++i) {
+            int cfd = events[i].data.fd;
+            if (cfd == fd) {
+                continue;
+            }
+            if (cfd == g_data->wake_fd) {
+                uint64_t cnt = 0;
+                (void)!read(cfd, &cnt, sizeof(cnt));
+                continue;
+            }
+            Conn *conn = g_data->fd2conn[cfd];
+            if (events[i].events & EPOLLRDHUP) {
+                conn->rdhup = true;
+            }
+            connection_io(conn);
+            if (conn->state == STATE_END) {
+                conn_done(conn);
+            } else {
+                conn_update_events(conn);
+            }
+        }
 
+        shard_poll();
+        process_timers();
+        backlog = shard_flush();
+    }
+}
 
-        for (size_t i = 1; i < poll_args.size(); ++i) {
-            if (poll_args[i].revents) {
-                Conn *conn = g_data.fd2conn[poll_args[i].fd];
-                connection_io(conn);
-                if (conn->state == STATE_END) {
-                  
+// with several shards each has a listener, and the kernel spreads the
+// connections among them through SO_REUSEPORT. the first one binds before
+// setting it, so a port held by another process fails bind() as it does
+// with one shard; the rest set it first to join the first one's group.
+static int listen_on(uint16_t port, bool first, bool shared) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        die("socket()");
+    }
 
-                    conn_done(conn);
-                }
+    int val = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+    if (shared && !first) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    }
+
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = ntohs(port);
+    addr.sin_addr.s_addr = ntohl(0);   
+    int rv = bind(fd, (const sockaddr *)&addr, sizeof(addr));
+    if (rv) {
+
+        die("bind()");
+
+    }
+    if (shared && first) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    }
+
+
+    rv = listen(fd, SOMAXCONN);
+    if (rv) {
+        die("listen()");
+    }
+
+
+    fd_set_nb(fd);
+    return fd;
+}
+
+static void *shard_main(void *arg) {
+    g_data = (Shard *)arg;
+    int fd = g_data->listen_fd;
+
+#ifdef USE_URING
+    if (!g_force_epoll
+        && 0 == uring_init(&g_data->ring, 4096)
+        && 0 == uring_bufs_init(&g_data->ring, &g_data->bufs, k_uring_bgid,
+                                k_uring_nbufs, k_uring_buf_size))
+    {
+        if (g_data->id == 0) {
+            msg("using io_uring");
+        }
+        g_data->uring = true;
+        uring_loop(fd);
+    }
+    uring_exit(&g_data->ring);
+#endif
+    epoll_loop(fd);
+    return NULL;
+}
+
+// each shard pair has a queue, so this also bounds nshards^2 of them
+const uint32_t k_max_shards = 256;
+
+int main(int argc, char **argv) {
+    uint32_t nshards = 1;
+    for (int i = 1; i < argc; ++i) {
+        if (0 == strcmp(argv[i], "--epoll")) {
+            // to compare against the io_uring path
+            g_force_epoll = true;
+        } else if (0 == strcmp(argv[i], "--threads") && i + 1 < argc) {
+            char *end = NULL;
+            unsigned long v = strtoul(argv[++i], &end, 10);
+            // strtoul() takes "-1" as ULONG_MAX, the digit check refuses it
+            bool ok = argv[i][0] >= '0' && argv[i][0] <= '9' && *end == '\0';
+            nshards = ok && v <= k_max_shards ? (uint32_t)v : 0;
+            if (nshards == 0) {
+                break;
             }
+        } else if (0 == strcmp(argv[i], "--max-msg") && i + 1 < argc) {
+            g_max_msg = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (0 == strcmp(argv[i], "--zset-index") && i + 1 < argc
+            && parse_zindex(argv[i + 1], g_zset_index))
+        {
+            ++i;
+        } else {
+            nshards = 0;
+            break;
         }
+    }
+    if (nshards == 0) {
+        fprintf(stderr, "usage: %s [--epoll] [--threads 1-%u] [--max-msg BYTES]"
+            " [--zset-index avl|btree]\n", argv[0], k_max_shards);
+        return 1;
+    }
 
-       process_timers();
+    thread_pool_init(&g_tp, 4);
+    cmd_init();
 
-        if (poll_args[0].revents) {
-            (void)accept_new_conn(fd);
+    const size_t k_queue_size = 4096;
+    size_t nqueues = (size_t)nshards * nshards;
+    g_queues.reset(new SPSCQueue[nqueues]);
+    for (size_t i = 0; i < nqueues; ++i) {
+        spsc_init(&g_queues[i], k_queue_size);
+    }
+    for (uint32_t i = 0; i < nshards; ++i) {
+        Shard *shard = new Shard();
+        shard->id = i;
+        dlist_init(&shard->idle_list);
+        shard->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (shard->wake_fd < 0) {
+            die("eventfd()");
         }
+        shard->outbox.resize(nshards);
+        shard->dirty.assign(nshards, 0);
+        shard->calls.reset(new std::atomic<uint64_t>[k_ncmds]());
+        // in order, before any shard runs, see listen_on()
+        shard->listen_fd = listen_on(1234, i == 0, nshards > 1);
+        g_shards.push_back(shard);
     }
 
+    // shard 0 runs on the main thread
+    for (uint32_t i = 1; i < nshards; ++i) {
+        pthread_t th;
+        int rv = pthread_create(&th, NULL, &shard_main, g_shards[i]);
+        if (rv) {
+            errno = rv;
+            die("pthread_create()");
+        }
+    }
+    shard_main(g_shards[0]);
     return 0;
 }
@@ -0,0 +1,229 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <atomic>
+#include <new>
+#include "common.h"
+#include "list.h"
+#include "slab.h"
+
+
+const size_t k_nclasses = k_slab_max / k_slab_step;
+
+struct SlabHeap;
+
+// the header at the start of each page, objects follow
+struct SlabPage {
+    DList link;             // in the partial or the full list of its class
+    SlabHeap *heap = nullptr;   // the owner
+    uint32_t cls = 0;
+    uint32_t used = 0;      // objects out, as far as the owner knows
+    bool full = false;
+    void *free = nullptr;   // freed by the owner
+    char *bump = nullptr;   // never handed out from here to `end`
+    char *end = nullptr;
+    std::atomic<void *> remote{nullptr};    // freed by other threads
+};
+
+struct SlabHeap {
+    DList partial[k_nclasses];  // pages that may have room, front first
+    DList full[k_nclasses];
+    // bumped by other threads after each free, tells there is something
+    // to collect on the full pages
+    std::atomic<size_t> remote_pending{0};
+    SlabStats stats;
+};
+
+static thread_local SlabHeap *t_heap = nullptr;
+
+static SlabHeap *heap_get() {
+    if (!t_heap) {
+        // never freed, other threads may still hand objects back to it
+        t_heap = new SlabHeap();
+        for (size_t i = 0; i < k_nclasses; ++i) {
+            dlist_init(&t_heap->partial[i]);
+            dlist_init(&t_heap->full[i]);
+        }
+    }
+    return t_heap;
+}
+
+static size_t class_of(size_t size) {
+    return size ? (size - 1) / k_slab_step : 0;
+}
+
+static size_t class_size(size_t cls) {
+    return (cls + 1) * k_slab_step;
+}
+
+static SlabPage *page_of(void *ptr) {
+    return (SlabPage *)((uintptr_t)ptr & ~(uintptr_t)(k_slab_page - 1));
+}
+
+static SlabPage *page_new(SlabHeap *heap, size_t cls) {
+    void *mem = aligned_alloc(k_slab_page, k_slab_page);
+    if (!mem) {
+        abort();
+    }
+    SlabPage *page = new (mem) SlabPage();
+    page->heap = heap;
+    page->cls = (uint32_t)cls;
+    size_t hdr = (sizeof(SlabPage) + k_slab_step - 1) & ~(k_slab_step - 1);
+    page->bump = (char *)mem + hdr;
+    page->end = (char *)mem + k_slab_page;
+    dlist_insert_before(heap->partial[cls].next, &page->link);
+    heap->stats.pages++;
+    return page;
+}
+
+static void page_release(SlabHeap *heap, SlabPage *page) {
+    dlist_detach(&page->link);
+    heap->stats.pages--;
+    page->~SlabPage();
+    free(page);
+}
+
+// move what other threads freed to the owner's list
+static void page_collect(SlabHeap *heap, SlabPage *page) {
+    void *ptr = page->remote.exchange(nullptr, std::memory_order_acquire);
+    while (ptr) {
+        void *next = *(void **)ptr;
+        *(void **)ptr = page->free;
+        page->free = ptr;
+        page->used--;
+        heap->stats.objects--;
+        heap->stats.bytes -= class_size(page->cls);
+        heap->stats.remote_frees++;
+        ptr = next;
+    }
+}
+
+// after objects came back: a full page has room again, an empty one is
+// released unless it is the last page with room in its class
+static void page_settle(SlabHeap *heap, SlabPage *page) {
+    DList *partial = &heap->partial[page->cls];
+    if (page->full) {
+        dlist_detach(&page->link);
+        dlist_insert_before(partial->next, &page->link);
+        page->full = false;
+    }
+    if (page->used == 0 && !(partial->next == &page->link && partial->prev == &page->link)) {
+        page_release(heap, page);
+    }
+}
+
+static void *page_pop(SlabHeap *heap, SlabPage *page) {
+    if (!page->free && page->remote.load(std::memory_order_relaxed)) {
+        page_collect(heap, page);
+    }
+    void *ptr = page->free;
+    if (ptr) {
+        page->free = *(void **)ptr;
+    } else if (page->bump + class_size(page->cls) <= page->end) {
+        // carved only when needed, untouched memory stays unmapped
+        ptr = page->bump;
+        page->bump += class_size(page->cls);
+    }
+    return ptr;
+}
+
+static void heap_collect(SlabHeap *heap) {
+    if (heap->remote_pending.exchange(0, std::memory_order_acquire) == 0) {
+        return;
+    }
+    for (size_t cls = 0; cls < k_nclasses; ++cls) {
+        DList *lists[2] = {&heap->full[cls], &heap->partial[cls]};
+        for (DList *list : lists) {
+            DList *node = list->next;
+            while (node != list) {
+                SlabPage *page = container_of(node, SlabPage, link);
+                node = node->next;  // the page may move or go
+                if (page->remote.load(std::memory_order_relaxed)) {
+                    page_collect(heap, page);
+                    page_settle(heap, page);
+                }
+            }
+        }
+    }
+}
+
+void *slab_alloc(size_t size) {
+    if (size > k_slab_max) {
+        void *ptr = malloc(size);
+        if (!ptr) {
+            abort();
+        }
+        return ptr;
+    }
+    SlabHeap *heap = heap_get();
+    size_t cls = class_of(size);
+    DList *partial = &heap->partial[cls];
+    for (;;) {
+        if (dlist_empty(partial)) {
+            heap_collect(heap);
+        }
+        if (dlist_empty(partial)) {
+            page_new(heap, cls);
+        }
+        SlabPage *page = container_of(partial->next, SlabPage, link);
+        void *ptr = page_pop(heap, page);
+        if (ptr) {
+            page->used++;
+            heap->stats.objects++;
+            heap->stats.bytes += class_size(cls);
+            return ptr;
+        }
+        // out of room until something is freed on it
+        dlist_detach(&page->link);
+        dlist_insert_before(&heap->full[cls], &page->link);
+        page->full = true;
+    }
+}
+
+size_t slab_usable(void *ptr, size_t size) {
+    if (size > k_slab_max) {
+        return malloc_usable_size(ptr);
+    }
+    return class_size(class_of(size));
+}
+
+void slab_free(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    if (size > k_slab_max) {
+        free(ptr);
+        return;
+    }
+    SlabPage *page = page_of(ptr);
+    assert(page->cls == class_of(size));
+    SlabHeap *heap = page->heap;
+    if (heap == t_heap) {
+        *(void **)ptr = page->free;
+        page->free = ptr;
+        page->used--;
+        heap->stats.objects--;
+        heap->stats.bytes -= class_size(page->cls);
+        page_settle(heap, page);
+        return;
+    }
+    // the owner may take it and release the page as soon as it is
+    // pushed, `heap` was read before
+    void *head = page->remote.load(std::memory_order_relaxed);
+    do {
+        *(void **)ptr = head;
+    } while (!page->remote.compare_exchange_weak(
+        head, ptr, std::memory_order_release, std::memory_order_relaxed));
+    heap->remote_pending.fetch_add(1, std::memory_order_release);
+}
+
+void slab_collect() {
+    if (t_heap) {
+        heap_collect(t_heap);
+    }
+}
+
+SlabStats slab_stats() {
+    return t_heap ? t_heap->stats : SlabStats();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+
+
+// the small objects there are millions of (keyspace entries, zset nodes)
+// come from per-thread slabs: 64 KB pages each carved into one size
+// class, in 16-byte steps up to k_slab_max. any thread may free an
+// object; one freed off its owner thread goes on a lock-free list of its
+// page, and the owner takes it back when that class runs out, or in
+// slab_collect(). larger requests go to malloc.
+const size_t k_slab_page = 64 * 1024;
+const size_t k_slab_step = 16;
+const size_t k_slab_max = 256;
+
+void *slab_alloc(size_t size);
+// the bytes that can be used of a block from slab_alloc(size)
+size_t slab_usable(void *ptr, size_t size);
+// `size` is anything from what was asked for up to slab_usable()
+void slab_free(void *ptr, size_t size);
+// take back what other threads freed, pages left empty are released
+void slab_collect();
+
+// the calling thread's slabs
+struct SlabStats {
+    size_t pages = 0;
+    size_t objects = 0;         // handed out
+    size_t bytes = 0;           // handed out, by size class
+    size_t remote_frees = 0;    // objects freed by other threads
+};
+
+SlabStats slab_stats();
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <assert.h>
+#include <atomic>
+#include <vector>
+
+
+// bounded lock-free queue for exactly one producer and one consumer thread
+struct SPSCQueue {
+    std::vector<void *> slots;
+    size_t mask = 0;
+    // producer and consumer indexes live on separate cache lines
+    alignas(64) std::atomic<size_t> head{0};    // next slot to pop
+    alignas(64) std::atomic<size_t> tail{0};    // next slot to push
+};
+
+inline void spsc_init(SPSCQueue *q, size_t n) {
+    assert(n > 0 && ((n - 1) & n) == 0);
+    q->slots.assign(n, nullptr);
+    q->mask = n - 1;
+    q->head = 0;
+    q->tail = 0;
+}
+
+// false when the queue is full
+inline bool spsc_push(SPSCQueue *q, void *item) {
+    size_t tail = q->tail.load(std::memory_order_relaxed);
+    if (tail - q->head.load(std::memory_order_acquire) > q->mask) {
+        return false;
+    }
+    q->slots[tail & q->mask] = item;
+    q->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// nullptr when the queue is empty
+inline void *spsc_pop(SPSCQueue *q) {
+    size_t head = q->head.load(std::memory_order_relaxed);
+    if (head == q->tail.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    void *item = q->slots[head & q->mask];
+    q->head.store(head + 1, std::memory_order_release);
+    return item;
+}
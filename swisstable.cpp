@@ -0,0 +1,288 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <utility>
+#include "swisstable.h"
+
+SwissTable::~SwissTable() {
+    free(ctrl);
+    free(slots);
+}
+
+SwissTable::SwissTable(SwissTable&& other) noexcept {
+    *this = std::move(other);
+}
+
+SwissTable& SwissTable::operator=(SwissTable&& other) noexcept {
+    if (this != &other) {
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(mask, other.mask);
+        std::swap(size, other.size);
+        std::swap(tombstones, other.tombstones);
+        std::swap(max_used, other.max_used);
+    }
+    return *this;
+}
+
+void SwissTable::init(size_t n) {
+    assert(n >= kGroupSize && ((n - 1) & n) == 0);
+    free(ctrl);
+    free(slots);
+    // malloc alignment covers a group
+    ctrl = (int8_t*)calloc(n, 1);
+    slots = (HashLink**)malloc(n * sizeof(HashLink*));
+    if (!ctrl || !slots) {
+        abort();
+    }
+    assert(((uintptr_t)ctrl & (kGroupSize - 1)) == 0);
+    mask = n - 1;
+    size = 0;
+    tombstones = 0;
+    max_used = n / 8 * 7;
+}
+
+void SwissTable::allocate(size_t n) {
+    assert(n >= kGroupSize && ((n - 1) & n) == 0);
+    free(ctrl);
+    free(slots);
+    ctrl = (int8_t*)malloc(n);
+    slots = (HashLink**)malloc(n * sizeof(HashLink*));
+    if (!ctrl || !slots) {
+        abort();
+    }
+    assert(((uintptr_t)ctrl & (kGroupSize - 1)) == 0);
+    mask = n - 1;
+    size = 0;
+    tombstones = 0;
+    max_used = n / 8 * 7;
+}
+
+void SwissTable::clear(size_t begin, size_t end) {
+    memset(&ctrl[begin], kEmpty, end - begin);
+    // empty slots are never read, this only takes the page faults now
+    memset(&slots[begin], 0, (end - begin) * sizeof(HashLink*));
+}
+
+void SwissTable::insert(HashLink* node) {
+    assert(size + tombstones < max_used);
+    uint64_t hash = node->hashcode;
+    size_t gmask = mask / kGroupSize;
+    size_t g = hash & gmask;
+    for (size_t i = 1; ; ++i) {
+        int8_t* group = &ctrl[g * kGroupSize];
+        uint32_t bits = ~groupFull(group) & 0xFFFF;
+        if (bits) {
+            size_t index = g * kGroupSize + __builtin_ctz(bits);
+            if (ctrl[index] == kDeleted) {
+                tombstones--;
+            }
+            ctrl[index] = tag(hash);
+            slots[index] = node;
+            size++;
+            return;
+        }
+        g = (g + i) & gmask;
+    }
+}
+
+HashLink* SwissTable::extract(size_t index) {
+    HashLink* node = slots[index];
+    // a group that still has an empty slot never sent a probe further,
+    // so nothing relies on this slot being occupied
+    const int8_t* group = &ctrl[index & ~(kGroupSize - 1)];
+    if (groupMatch(group, kEmpty)) {
+        ctrl[index] = kEmpty;
+    } else {
+        ctrl[index] = kDeleted;
+        tombstones++;
+    }
+    size--;
+    return node;
+}
+
+void SwissMap::insert(HashLink* item) {
+    if (!newer.ctrl) {
+        newer.init(SwissTable::kGroupSize);
+    }
+    if (newer.full()) {
+        // the step size makes this unreachable, but never overfill
+        while (older.ctrl) {
+            processResize();
+        }
+        initiateResize();
+    }
+    newer.insert(item);
+    processResize();
+}
+
+// slots of a table that holds `live` nodes at most 7/16 full
+static size_t resize_slots(size_t live) {
+    size_t n = SwissTable::kGroupSize;
+    while (n / 16 * 7 < live) {
+        n *= 2;
+    }
+    return n;
+}
+
+void SwissMap::initiateResize() {
+    assert(!older.ctrl);
+    size_t live = newer.size;
+    size_t n = resize_slots(live);
+    older = std::move(newer);
+    if (spare.capacity() == n) {
+        // only left to do if `newer` filled up faster than expected
+        spare.clear(spare_pos, n);
+        newer = std::move(spare);
+    } else {
+        spare = SwissTable();
+        newer.init(n);
+    }
+    spare_pos = 0;
+    resize_pos = 0;
+    // visit all of `older` before inserts can fill `newer`
+    size_t room = newer.max_used - live;
+    resize_step = older.capacity() / room + 1;
+    if (resize_step < kResizingWorkload) {
+        resize_step = kResizingWorkload;
+    }
+}
+
+// gives the whole pages in bytes [lo, hi) of an allocation of `bytes`
+// at `p` back to the kernel, leaving free() little to unmap. the pages
+// on the edges of the allocation are malloc's and stay.
+static void give_back(void* p, size_t bytes, size_t lo, size_t hi) {
+    static const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t base = (uintptr_t)p;
+    uintptr_t first = (base + lo + page - 1) & ~(page - 1);
+    uintptr_t last = (base + hi + page - 1) & ~(page - 1);
+    uintptr_t limit = (base + bytes) & ~(page - 1);
+    if (last > limit) {
+        last = limit;
+    }
+    if (first < last) {
+        madvise((void*)first, last - first, MADV_DONTNEED);
+    }
+}
+
+void SwissMap::processResize() {
+    if (!older.ctrl) {
+        if (retired.ctrl) {
+            size_t cap = retired.capacity();
+            size_t end = retired_pos + kReleaseWorkload;
+            if (end > cap) {
+                end = cap;
+            }
+            give_back(retired.ctrl, cap, retired_pos, end);
+            give_back(retired.slots, cap * sizeof(HashLink*),
+                retired_pos * sizeof(HashLink*), end * sizeof(HashLink*));
+            retired_pos = end;
+            if (retired_pos == cap) {
+                retired = SwissTable();
+            }
+        } else {
+            prepareSpare();
+        }
+        return;
+    }
+    size_t end = resize_pos + resize_step;
+    if (end > older.capacity()) {
+        end = older.capacity();
+    }
+    while (resize_pos < end && older.size > 0) {
+        // a group at a time, only full slots move
+        size_t g = resize_pos / SwissTable::kGroupSize;
+        uint32_t full = SwissTable::groupFull(&older.ctrl[g * SwissTable::kGroupSize]);
+        while (full) {
+            size_t index = g * SwissTable::kGroupSize + __builtin_ctz(full);
+            // a tombstone, not empty: probes in `older` must go past it
+            older.ctrl[index] = SwissTable::kDeleted;
+            older.size--;
+            newer.insert(older.slots[index]);
+            full &= full - 1;
+        }
+        resize_pos = (g + 1) * SwissTable::kGroupSize;
+    }
+    if (older.size == 0) {
+        if (older.capacity() < kStepwiseMin) {
+            older = SwissTable();
+        } else {
+            // the move swaps, so a previous table still being given
+            // back lands in `older` and is freed at once
+            retired = std::move(older);
+            older = SwissTable();
+            retired_pos = 0;
+        }
+        resize_pos = 0;
+    }
+}
+
+void SwissMap::prepareSpare() {
+    if (!spare.ctrl) {
+        // a growth doubles the table, clearing the new one takes a step
+        // per kResizingWorkload of its slots
+        size_t n = newer.capacity() * 2;
+        size_t room = newer.max_used - newer.size - newer.tombstones;
+        if (n < kStepwiseMin || room > n / kResizingWorkload + 1) {
+            return;
+        }
+        // what initiateResize() picks once the room is used up. with
+        // many tombstones it rebuilds at the same size instead.
+        if (resize_slots(newer.max_used - newer.tombstones) != n) {
+            return;
+        }
+        spare.allocate(n);
+        spare_pos = 0;
+    }
+    if (spare_pos < spare.capacity()) {
+        size_t end = spare_pos + kResizingWorkload;
+        spare.clear(spare_pos, end);
+        spare_pos = end;
+    }
+}
+
+void SwissMap::replace(HashLink* old, HashLink* node) {
+    node->hashcode = old->hashcode;
+    auto same = [old](HashLink* h) { return h == old; };
+    ptrdiff_t index = newer.locate(old->hashcode, same);
+    if (index >= 0) {
+        newer.slots[index] = node;
+        return;
+    }
+    index = older.locate(old->hashcode, same);
+    assert(index >= 0);
+    older.slots[index] = node;
+}
+
+void SwissMap::maybeShrink() {
+    if (older.ctrl || newer.capacity() <= SwissTable::kGroupSize) {
+        return;     // a resize is under way, or already the smallest
+    }
+    if (newer.size * kShrinkRatio < newer.capacity()) {
+        initiateResize();
+    }
+}
+
+void SwissMap::freeUp() {
+    newer = SwissTable();
+    older = SwissTable();
+    spare = SwissTable();
+    retired = SwissTable();
+    resize_pos = 0;
+    spare_pos = 0;
+    retired_pos = 0;
+}
+
+static void table_for_each(SwissTable& t, void (*f)(HashLink*, void*), void* arg) {
+    for (size_t i = 0; i < t.capacity(); ++i) {
+        if (t.ctrl[i] < 0) {
+            f(t.slots[i], arg);
+        }
+    }
+}
+
+void SwissMap::forEach(void (*f)(HashLink*, void*), void* arg) {
+    table_for_each(newer, f, arg);
+    table_for_each(older, f, arg);
+}
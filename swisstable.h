@@ -0,0 +1,503 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <functional>
+#include <utility>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "common.h"
+
+
+/**
+ * @struct HashLink
+ * @brief What a node embeds to be stored in a SwissMap
+ *
+ * Open addressing needs no chain pointer, only the cached hash.
+ */
+struct HashLink {
+    uint64_t hashcode;
+};
+
+/**
+ * @class SwissTable
+ * @brief Open addressing table of HashLink pointers, probed a group at a time
+ *
+ * Every slot has a control byte: empty, deleted, or the top 7 bits of the
+ * hash of the node it holds. A lookup loads the 16 control bytes of a group
+ * and compares them all at once (SSE2), so only slots whose hash fragment
+ * matches are dereferenced. Groups are probed in triangular order.
+ */
+class SwissTable {
+public:
+    static const size_t kGroupSize = 16;
+
+    // A full slot holds the top 7 bits of its hash with the sign bit set.
+    // Empty is 0 so a fresh table comes zeroed from calloc.
+    static const int8_t kEmpty = 0;
+    static const int8_t kDeleted = 1;
+
+    SwissTable() = default;
+    ~SwissTable();
+
+    SwissTable(SwissTable&& other) noexcept;
+    SwissTable& operator=(SwissTable&& other) noexcept;
+    SwissTable(const SwissTable&) = delete;
+    SwissTable& operator=(const SwissTable&) = delete;
+
+    /**
+     * @brief Allocate an empty table
+     * @param n Number of slots (a power of 2, at least kGroupSize)
+     */
+    void init(size_t n);
+
+    /**
+     * @brief Allocate a table without clearing it, see clear()
+     * @param n Number of slots (a power of 2, at least kGroupSize)
+     *
+     * Nothing may be inserted before every slot has been cleared.
+     */
+    void allocate(size_t n);
+
+    /**
+     * @brief Mark slots [begin, end) empty, faulting their pages in
+     */
+    void clear(size_t begin, size_t end);
+
+    /**
+     * @brief Insert a node, the key must not be present yet
+     * @param node Pointer to the node to insert, hashcode already set
+     */
+    void insert(HashLink* node);
+
+    /**
+     * @brief Find the slot holding a node
+     * @param hash Hash of the key
+     * @param eq Called on nodes with the same hash, true on a match
+     * @return Slot index, or -1 if not found
+     */
+    template <class Eq>
+    ptrdiff_t locate(uint64_t hash, Eq& eq) const;
+
+    /**
+     * @brief Remove the node in a slot, leaving a tombstone
+     * @param index Slot returned by locate()
+     * @return The removed node
+     */
+    HashLink* extract(size_t index);
+
+    /**
+     * @brief Whether another insert would go over the maximum load
+     */
+    bool full() const { return size + tombstones >= max_used; }
+
+    /**
+     * @brief Number of slots, 0 before init()
+     */
+    size_t capacity() const { return ctrl ? mask + 1 : 0; }
+
+    /**
+     * @brief Control byte of a full slot, the top 7 bits of the hash.
+     * The low bits of the same hash pick the group.
+     */
+    static int8_t tag(uint64_t hash) { return (int8_t)(0x80 | (hash >> 57)); }
+
+    /**
+     * @brief Bit i set if control byte i of the group equals `b`
+     */
+    static uint32_t groupMatch(const int8_t* g, int8_t b);
+
+    /**
+     * @brief Bit i set if slot i of the group holds a node
+     */
+    static uint32_t groupFull(const int8_t* g);
+
+    // Public members for internal access
+    int8_t* ctrl = nullptr;     // 16-byte aligned, one byte per slot
+    HashLink** slots = nullptr;
+    size_t mask = 0;            // slots - 1
+    size_t size = 0;
+    size_t tombstones = 0;
+    size_t max_used = 0;        // live + deleted slots allowed
+};
+
+inline uint32_t SwissTable::groupMatch(const int8_t* g, int8_t b) {
+#ifdef __SSE2__
+    __m128i c = _mm_load_si128((const __m128i*)g);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(b)));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < kGroupSize; ++i) {
+        bits |= (uint32_t)(g[i] == b) << i;
+    }
+    return bits;
+#endif
+}
+
+inline uint32_t SwissTable::groupFull(const int8_t* g) {
+    // only full slots have the sign bit set
+#ifdef __SSE2__
+    return (uint32_t)_mm_movemask_epi8(_mm_load_si128((const __m128i*)g));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < kGroupSize; ++i) {
+        bits |= (uint32_t)(g[i] < 0) << i;
+    }
+    return bits;
+#endif
+}
+
+template <class Eq>
+ptrdiff_t SwissTable::locate(uint64_t hash, Eq& eq) const {
+    if (!ctrl) {
+        return -1;
+    }
+    int8_t t = tag(hash);
+    size_t gmask = mask / kGroupSize;
+    size_t g = hash & gmask;
+    for (size_t i = 1; ; ++i) {
+        const int8_t* group = &ctrl[g * kGroupSize];
+        uint32_t bits = groupMatch(group, t);
+        while (bits) {
+            size_t index = g * kGroupSize + __builtin_ctz(bits);
+            HashLink* node = slots[index];
+            if (node->hashcode == hash && eq(node)) {
+                return (ptrdiff_t)index;
+            }
+            bits &= bits - 1;
+        }
+        // a key is never placed past a group that had room
+        if (groupMatch(group, kEmpty)) {
+            return -1;
+        }
+        g = (g + i) & gmask;
+    }
+}
+
+/**
+ * @class SwissMap
+ * @brief SwissTable with progressive resizing
+ *
+ * Like HashMap, growing moves the nodes over a few slots per operation,
+ * so no single call pays for the whole rehash. Shrinking after mass
+ * deletes works the same way: a resize leaves the table at most 7/16 full
+ * and it only shrinks below 1/8, so it does not flap. Large tables are
+ * also set up and freed a step at a time: the one a growth moves into is
+ * cleared while the current one fills its last slots, and the emptied one
+ * is handed back to the kernel a few pages per operation. Nodes carry
+ * their hash and keys are matched by a predicate inlined into the probe
+ * loop. IntrusiveMap wraps it for typed access.
+ */
+class SwissMap {
+public:
+    /**
+     * @brief Insert a node, its hashcode must be set
+     */
+    void insert(HashLink* item);
+
+    /**
+     * @brief Find a node
+     * @param hash Hash of the key
+     * @param eq Called on candidate nodes, true on a match
+     * @return The node, or nullptr if not found
+     */
+    template <class Eq>
+    HashLink* search(uint64_t hash, Eq eq);
+
+    /**
+     * @brief Remove a node
+     * @return The removed node, or nullptr if not found
+     */
+    template <class Eq>
+    HashLink* erase(uint64_t hash, Eq eq);
+
+    /**
+     * @brief Put `node` in the slot of `old`, e.g. after reallocating it
+     */
+    void replace(HashLink* old, HashLink* node);
+
+    size_t size() const { return newer.size + older.size; }
+    void freeUp();
+
+    /**
+     * @brief Slots allocated, both tables while a resize is under way
+     */
+    size_t capacity() const { return newer.capacity() + older.capacity(); }
+
+    /**
+     * @brief Live nodes per slot of the table inserts go to
+     */
+    double loadFactor() const {
+        return newer.ctrl ? (double)size() / (double)newer.capacity() : 0;
+    }
+
+    /**
+     * @brief Call `f` on every node, in no particular order
+     */
+    void forEach(void (*f)(HashLink*, void*), void* arg);
+
+    /**
+     * @brief Call `f` on the nodes under one cursor position
+     * @param cursor 0 to start, then the value returned by the last call
+     * @return The next cursor, 0 once the whole map has been visited
+     *
+     * Positions are groups by hash, visited in reverse-binary order like
+     * Redis' dictScan, so the cursor stays valid when the table grows or
+     * shrinks between calls. Every node present for the whole scan is
+     * visited at least once; some may be visited twice.
+     */
+    template <class F>
+    uint64_t scan(uint64_t cursor, F&& f) const;
+
+    /**
+     * @brief Start moving into a fresh table sized to be at most 7/16
+     * full: larger when growing, smaller when shrinking, the same size
+     * when the current one is mostly tombstones
+     */
+    void initiateResize();
+
+    /**
+     * @brief Move a batch of slots into the new table, or else give back
+     * a batch of the emptied one or clear a batch of the next one
+     */
+    void processResize();
+
+    /**
+     * @brief Clear a batch of `spare`, allocating it once `newer` is close
+     * enough to full that the rest of its room covers the clearing
+     */
+    void prepareSpare();
+
+    /**
+     * @brief Start shrinking if the load is below 1/kShrinkRatio
+     */
+    void maybeShrink();
+
+    static const size_t kResizingWorkload = 128;    // Minimum slots visited per step
+    static const size_t kShrinkRatio = 8;
+    static const size_t kStepwiseMin = 1 << 14;     // Smaller tables are set up and freed at once
+    static const size_t kReleaseWorkload = 2048;    // Slots of `retired` given back per step
+
+    size_t resize_pos = 0;      // Next slot of `older` to move
+    size_t resize_step = 0;     // Slots visited per step of this resize
+    SwissTable newer;           // Where inserts go
+    SwissTable older;           // Being emptied into `newer`
+    SwissTable spare;           // The next `newer` of a growth, cleared a step at a time
+    size_t spare_pos = 0;       // Slots of `spare` cleared so far
+    SwissTable retired;         // The emptied `older`, given back a step at a time
+    size_t retired_pos = 0;     // Slots of `retired` given back so far
+};
+
+template <class Eq>
+HashLink* SwissMap::search(uint64_t hash, Eq eq) {
+    processResize();
+    ptrdiff_t index = newer.locate(hash, eq);
+    if (index >= 0) {
+        return newer.slots[index];
+    }
+    index = older.locate(hash, eq);
+    return index >= 0 ? older.slots[index] : nullptr;
+}
+
+template <class Eq>
+HashLink* SwissMap::erase(uint64_t hash, Eq eq) {
+    processResize();
+    ptrdiff_t index = newer.locate(hash, eq);
+    HashLink* node = nullptr;
+    if (index >= 0) {
+        node = newer.extract(index);
+    } else if ((index = older.locate(hash, eq)) >= 0) {
+        node = older.extract(index);
+    }
+    if (node) {
+        maybeShrink();
+    }
+    return node;
+}
+
+// groups of `t` minus one, the mask a scan cursor is taken modulo
+inline uint64_t scanMask(const SwissTable& t) {
+    return t.capacity() / SwissTable::kGroupSize - 1;
+}
+
+// the cursor after `v`, counting with the bits in `mask` reversed
+inline uint64_t scanNext(uint64_t v, uint64_t mask) {
+    v |= ~mask;
+    v = __builtin_bswap64(v);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v++;
+    v = __builtin_bswap64(v);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    return v;
+}
+
+// the nodes whose hash picks group `home`. they sit on its probe
+// sequence, no further than the first group with an empty slot.
+template <class F>
+void scanHome(const SwissTable& t, uint64_t home, F& f) {
+    size_t gmask = scanMask(t);
+    size_t g = home;
+    for (size_t i = 1; i <= gmask + 1; ++i) {
+        const int8_t* group = &t.ctrl[g * SwissTable::kGroupSize];
+        uint32_t bits = SwissTable::groupFull(group);
+        while (bits) {
+            HashLink* node = t.slots[g * SwissTable::kGroupSize + __builtin_ctz(bits)];
+            if ((node->hashcode & gmask) == home) {
+                f(node);
+            }
+            bits &= bits - 1;
+        }
+        if (SwissTable::groupMatch(group, SwissTable::kEmpty)) {
+            break;
+        }
+        g = (g + i) & gmask;
+    }
+}
+
+template <class F>
+uint64_t SwissMap::scan(uint64_t cursor, F&& f) const {
+    if (!newer.ctrl) {
+        return 0;
+    }
+    if (!older.ctrl) {
+        uint64_t m = scanMask(newer);
+        scanHome(newer, cursor & m, f);
+        return scanNext(cursor, m);
+    }
+    const SwissTable* small = &newer;
+    const SwissTable* large = &older;
+    if (small->capacity() > large->capacity()) {
+        std::swap(small, large);
+    }
+    uint64_t m0 = scanMask(*small);
+    uint64_t m1 = scanMask(*large);
+    scanHome(*small, cursor & m0, f);
+    // then every group of the larger table the smaller one's splits into
+    do {
+        scanHome(*large, cursor & m1, f);
+        cursor = scanNext(cursor, m1);
+    } while (cursor & (m0 ^ m1));
+    return cursor;
+}
+
+/**
+ * @brief Default hasher, str_hash() over anything viewable as a string
+ */
+struct StrHash {
+    uint64_t operator()(std::string_view s) const {
+        return str_hash((const uint8_t*)s.data(), s.size());
+    }
+};
+
+/**
+ * @class IntrusiveMap
+ * @brief Typed SwissMap over nodes that embed a HashLink
+ *
+ * @tparam Node Stored type
+ * @tparam LinkOffset offsetof(Node, <its HashLink member>)
+ * @tparam KeyOf Functor returning the key of a `const Node&`
+ * @tparam Hash Functor hashing a key
+ * @tparam Equal Functor comparing a stored key with a lookup key
+ *
+ * All of them are known at compile time, so hashing and comparing inline
+ * into the probe loop. Lookups take any key type Hash and Equal accept,
+ * e.g. std::string_view for std::string keys, without building a node.
+ */
+template <class Node, size_t LinkOffset, class KeyOf,
+          class Hash = StrHash, class Equal = std::equal_to<>>
+class IntrusiveMap {
+public:
+    /**
+     * @brief Insert a node, its key must not be present yet
+     */
+    void insert(Node* node) {
+        HashLink* link = linkOf(node);
+        link->hashcode = Hash()(KeyOf()(*node));
+        map.insert(link);
+    }
+
+    /**
+     * @brief Find the node with a key
+     * @return The node, or nullptr if not found
+     */
+    template <class K>
+    Node* find(const K& key) {
+        HashLink* found = map.search(Hash()(key), [&key](HashLink* h) {
+            return Equal()(KeyOf()(*owner(h)), key);
+        });
+        return found ? owner(found) : nullptr;
+    }
+
+    /**
+     * @brief Remove the node with a key
+     * @return The removed node, or nullptr if not found
+     */
+    template <class K>
+    Node* erase(const K& key) {
+        HashLink* found = map.erase(Hash()(key), [&key](HashLink* h) {
+            return Equal()(KeyOf()(*owner(h)), key);
+        });
+        return found ? owner(found) : nullptr;
+    }
+
+    /**
+     * @brief Remove a node that is in the map, without comparing keys
+     */
+    void remove(Node* node) {
+        HashLink* link = linkOf(node);
+        HashLink* found = map.erase(link->hashcode, [link](HashLink* h) {
+            return h == link;
+        });
+        assert(found == link);
+        (void)found;
+    }
+
+    /**
+     * @brief Swap in `node` for `old`, which is in the map, with the same key
+     */
+    void replace(Node* old, Node* node) {
+        map.replace(linkOf(old), linkOf(node));
+    }
+
+    /**
+     * @brief Call `f(Node*)` on every node, in no particular order
+     */
+    template <class F>
+    void forEach(F&& f) {
+        map.forEach([](HashLink* h, void* arg) {
+            (*(std::remove_reference_t<F>*)arg)(owner(h));
+        }, (void*)&f);
+    }
+
+    /**
+     * @brief Call `f(Node*)` on the nodes under one cursor position,
+     * see SwissMap::scan()
+     */
+    template <class F>
+    uint64_t scan(uint64_t cursor, F&& f) const {
+        return map.scan(cursor, [&f](HashLink* h) { f(owner(h)); });
+    }
+
+    size_t size() const { return map.size(); }
+    size_t capacity() const { return map.capacity(); }
+    double loadFactor() const { return map.loadFactor(); }
+    void clear() { map.freeUp(); }
+
+    SwissMap map;
+
+private:
+    static HashLink* linkOf(Node* node) {
+        return (HashLink*)((char*)node + LinkOffset);
+    }
+
+    static Node* owner(HashLink* h) {
+        return (Node*)((char*)h - LinkOffset);
+    }
+};
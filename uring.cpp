@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+
+static unsigned load_acquire(unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void store_release(unsigned *p, unsigned v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+int uring_init(URing *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0) {
+        return -errno;
+    }
+    // one mmap for both rings, and timeouts passed to io_uring_enter()
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        close(fd);
+        return -ENOSYS;
+    }
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_ring_sz > ring->sq_ring_sz) {
+        ring->sq_ring_sz = ring->cq_ring_sz;
+    }
+    ring->cq_ring_sz = ring->sq_ring_sz;
+    void *sq = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        return -err;
+    }
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        int err = errno;
+        munmap(sq, ring->sq_ring_sz);
+        close(fd);
+        return -err;
+    }
+
+    uint8_t *base = (uint8_t *)sq;
+    ring->fd = fd;
+    ring->sq_ring = ring->cq_ring = sq;
+    ring->sq_head = (unsigned *)(base + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(base + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(base + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(base + p.sq_off.array);
+    ring->sqes = (struct io_uring_sqe *)sqes;
+    ring->sqe_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(base + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(base + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(base + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(base + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_exit(URing *ring) {
+    if (ring->fd < 0) {
+        return;
+    }
+    munmap(ring->sqes, ring->sqes_sz);
+    munmap(ring->sq_ring, ring->sq_ring_sz);
+    close(ring->fd);
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(URing *ring) {
+    unsigned head = load_acquire(ring->sq_head);
+    if (ring->sqe_tail - head > *ring->sq_mask) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit_and_wait(URing *ring, unsigned wait_nr, int timeout_ms) {
+    // publish the locally queued SQEs
+    unsigned tail = *ring->sq_tail;
+    unsigned to_submit = ring->sqe_tail - tail;
+    for (; tail != ring->sqe_tail; ++tail) {
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    }
+    store_release(ring->sq_tail, ring->sqe_tail);
+
+    struct __kernel_timespec ts = {};
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (wait_nr > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    int rv = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+        flags, &arg, sizeof(arg));
+    return rv < 0 ? -errno : rv;
+}
+
+struct io_uring_cqe *uring_peek_cqe(URing *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == load_acquire(ring->cq_tail)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(URing *ring) {
+    store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+int uring_bufs_init(URing *ring, URingBufs *bufs, uint16_t bgid,
+                    uint32_t nbufs, uint32_t buf_size)
+{
+    if (nbufs == 0 || (nbufs & (nbufs - 1)) || nbufs > 32768) {
+        return -EINVAL;
+    }
+    size_t ring_sz = nbufs * sizeof(struct io_uring_buf);
+    void *br = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (br == MAP_FAILED) {
+        return -errno;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)br;
+    reg.ring_entries = nbufs;
+    reg.bgid = bgid;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1)) {
+        int err = errno;
+        munmap(br, ring_sz);
+        return -err;
+    }
+
+    bufs->br = (struct io_uring_buf_ring *)br;
+    bufs->base = (uint8_t *)malloc((size_t)nbufs * buf_size);
+    bufs->nbufs = nbufs;
+    bufs->buf_size = buf_size;
+    bufs->bgid = bgid;
+    bufs->tail = 0;
+    for (uint32_t i = 0; i < nbufs; ++i) {
+        uring_buf_recycle(bufs, (uint16_t)i);
+    }
+    return 0;
+}
+
+uint8_t *uring_buf_addr(URingBufs *bufs, uint16_t bid) {
+    return bufs->base + (size_t)bid * bufs->buf_size;
+}
+
+void uring_buf_recycle(URingBufs *bufs, uint16_t bid) {
+    // not br->bufs: in C++ the header's flex array wrapper is not at offset 0
+    struct io_uring_buf *ring = (struct io_uring_buf *)bufs->br;
+    struct io_uring_buf *buf = &ring[bufs->tail & (bufs->nbufs - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buf_addr(bufs, bid);
+    buf->len = bufs->buf_size;
+    buf->bid = bid;
+    bufs->tail++;
+    __atomic_store_n(&bufs->br->tail, bufs->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+
+// a minimal io_uring wrapper over the raw syscalls (no liburing needed)
+struct URing {
+    int fd = -1;
+    // submission queue
+    unsigned *sq_head = NULL;
+    unsigned *sq_tail = NULL;
+    unsigned *sq_mask = NULL;
+    unsigned *sq_array = NULL;
+    struct io_uring_sqe *sqes = NULL;
+    unsigned sqe_tail = 0;      // local tail, published by uring_submit()
+    // completion queue
+    unsigned *cq_head = NULL;
+    unsigned *cq_tail = NULL;
+    unsigned *cq_mask = NULL;
+    struct io_uring_cqe *cqes = NULL;
+    // mappings
+    void *sq_ring = NULL;
+    size_t sq_ring_sz = 0;
+    void *cq_ring = NULL;
+    size_t cq_ring_sz = 0;
+    size_t sqes_sz = 0;
+};
+
+// a registered ring of equally sized buffers the kernel picks from
+struct URingBufs {
+    struct io_uring_buf_ring *br = NULL;
+    uint8_t *base = NULL;
+    uint32_t nbufs = 0;     // power of 2
+    uint32_t buf_size = 0;
+    uint16_t bgid = 0;
+    uint16_t tail = 0;
+};
+
+// returns 0, or -errno when the kernel lacks the features we rely on
+int uring_init(URing *ring, unsigned entries);
+void uring_exit(URing *ring);
+// NULL when the submission queue is full
+struct io_uring_sqe *uring_get_sqe(URing *ring);
+// submit everything queued and wait for `wait_nr` completions or timeout
+int uring_submit_and_wait(URing *ring, unsigned wait_nr, int timeout_ms);
+struct io_uring_cqe *uring_peek_cqe(URing *ring);
+void uring_cqe_seen(URing *ring);
+
+int uring_bufs_init(URing *ring, URingBufs *bufs, uint16_t bgid,
+                    uint32_t nbufs, uint32_t buf_size);
+uint8_t *uring_buf_addr(URingBufs *bufs, uint16_t bid);
+// hand a consumed buffer back to the kernel
+void uring_buf_recycle(URingBufs *bufs, uint16_t bid);
@@ -0,0 +1,123 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "zpack.h"
+
+
+static size_t pack_size(uint32_t cap, uint32_t bytes_cap) {
+    return sizeof(ZPack) + cap * (sizeof(double) + sizeof(uint16_t)) + bytes_cap;
+}
+
+size_t zpack_size(const ZPack *pack) {
+    return pack ? pack_size(pack->cap, pack->bytes_cap) : 0;
+}
+
+int32_t zpack_find(const ZPack *pack, std::string_view name) {
+    if (!pack) {
+        return -1;
+    }
+    const uint16_t *ends = zpack_ends(pack);
+    const char *names = zpack_names(pack);
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < pack->n; ++i) {
+        if (ends[i] - start == name.size()
+            && 0 == memcmp(names + start, name.data(), name.size()))
+        {
+            return (int32_t)i;
+        }
+        start = ends[i];
+    }
+    return -1;
+}
+
+uint32_t zpack_lower(const ZPack *pack, double score, std::string_view name) {
+    if (!pack) {
+        return 0;
+    }
+    // no early exit, so it vectorizes
+    const double *scores = zpack_scores(pack);
+    uint32_t i = 0;
+    for (uint32_t j = 0; j < pack->n; ++j) {
+        i += scores[j] < score;
+    }
+    while (i < pack->n && scores[i] == score && zpack_name(pack, i) < name) {
+        i++;
+    }
+    return i;
+}
+
+// room for one more member and `len` more bytes
+static ZPack *pack_reserve(ZPack *pack, size_t len) {
+    uint32_t n = pack ? pack->n : 0;
+    size_t bytes = pack ? zpack_bytes(pack) : 0;
+    if (pack && n < pack->cap && bytes + len <= pack->bytes_cap) {
+        return pack;
+    }
+    uint32_t cap = pack ? pack->cap : 0;
+    if (n == cap) {
+        cap = cap ? cap * 2 : 4;
+    }
+    uint32_t bytes_cap = pack ? pack->bytes_cap : 0;
+    while (bytes_cap < bytes + len) {
+        bytes_cap = bytes_cap ? bytes_cap * 2 : 32;
+    }
+    ZPack *grown = (ZPack *)malloc(pack_size(cap, bytes_cap));
+    if (!grown) {
+        abort();
+    }
+    grown->n = (uint16_t)n;
+    grown->cap = (uint16_t)cap;
+    grown->bytes_cap = bytes_cap;
+    if (pack) {
+        memcpy(zpack_scores(grown), zpack_scores(pack), n * sizeof(double));
+        memcpy(zpack_ends(grown), zpack_ends(pack), n * sizeof(uint16_t));
+        memcpy((char *)zpack_names(grown), zpack_names(pack), bytes);
+        free(pack);
+    }
+    return grown;
+}
+
+ZPack *zpack_insert(ZPack *pack, double score, std::string_view name) {
+    assert(name.size() <= k_zpack_max_name);
+    assert(!pack || pack->n < k_zpack_max_members);
+    uint32_t pos = zpack_lower(pack, score, name);
+    pack = pack_reserve(pack, name.size());
+
+    double *scores = zpack_scores(pack);
+    uint16_t *ends = zpack_ends(pack);
+    char *names = (char *)zpack_names(pack);
+    uint32_t start = pos ? ends[pos - 1] : 0;
+    size_t bytes = zpack_bytes(pack);
+    memmove(names + start + name.size(), names + start, bytes - start);
+    memcpy(names + start, name.data(), name.size());
+    memmove(&scores[pos + 1], &scores[pos], (pack->n - pos) * sizeof(double));
+    memmove(&ends[pos + 1], &ends[pos], (pack->n - pos) * sizeof(uint16_t));
+    scores[pos] = score;
+    ends[pos] = (uint16_t)(start + name.size());
+    pack->n++;
+    for (uint32_t i = pos + 1; i < pack->n; ++i) {
+        ends[i] = (uint16_t)(ends[i] + name.size());
+    }
+    return pack;
+}
+
+void zpack_erase(ZPack *pack, uint32_t pos) {
+    assert(pos < pack->n);
+    double *scores = zpack_scores(pack);
+    uint16_t *ends = zpack_ends(pack);
+    char *names = (char *)zpack_names(pack);
+    uint32_t start = pos ? ends[pos - 1] : 0;
+    uint32_t len = ends[pos] - start;
+    size_t bytes = zpack_bytes(pack);
+    memmove(names + start, names + ends[pos], bytes - ends[pos]);
+    memmove(&scores[pos], &scores[pos + 1], (pack->n - pos - 1) * sizeof(double));
+    memmove(&ends[pos], &ends[pos + 1], (pack->n - pos - 1) * sizeof(uint16_t));
+    pack->n--;
+    for (uint32_t i = pos; i < pack->n; ++i) {
+        ends[i] = (uint16_t)(ends[i] - len);
+    }
+}
+
+void zpack_free(ZPack *pack) {
+    free(pack);
+}
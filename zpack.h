@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string_view>
+
+
+// a small sorted set in one block: the scores, where each name ends,
+// then the names back to back, all in (score, name) order. lookups are
+// scans, which at this size beat chasing pointers; a set that outgrows
+// the limits moves to a ZNode per member.
+const uint32_t k_zpack_max_members = 128;
+const uint32_t k_zpack_max_name = 64;
+
+struct ZPack {
+    uint16_t n = 0;
+    uint16_t cap = 0;           // members
+    uint32_t bytes_cap = 0;     // name bytes
+    // double scores[cap];
+    // uint16_t ends[cap];
+    // char names[bytes_cap];
+};
+
+inline double *zpack_scores(ZPack *pack) {
+    return (double *)(pack + 1);
+}
+
+inline const double *zpack_scores(const ZPack *pack) {
+    return (const double *)(pack + 1);
+}
+
+inline uint16_t *zpack_ends(ZPack *pack) {
+    return (uint16_t *)(zpack_scores(pack) + pack->cap);
+}
+
+inline const uint16_t *zpack_ends(const ZPack *pack) {
+    return (const uint16_t *)(zpack_scores(pack) + pack->cap);
+}
+
+inline const char *zpack_names(const ZPack *pack) {
+    return (const char *)(zpack_ends(pack) + pack->cap);
+}
+
+inline size_t zpack_bytes(const ZPack *pack) {
+    return pack->n ? zpack_ends(pack)[pack->n - 1] : 0;
+}
+
+inline double zpack_score(const ZPack *pack, uint32_t i) {
+    return zpack_scores(pack)[i];
+}
+
+inline std::string_view zpack_name(const ZPack *pack, uint32_t i) {
+    uint16_t start = i ? zpack_ends(pack)[i - 1] : 0;
+    return std::string_view(zpack_names(pack) + start, zpack_ends(pack)[i] - start);
+}
+
+// the memory a pack takes, for the bytes per member reported
+size_t zpack_size(const ZPack *pack);
+// the position of `name`, or -1
+int32_t zpack_find(const ZPack *pack, std::string_view name);
+// the first position >= (score, name)
+uint32_t zpack_lower(const ZPack *pack, double score, std::string_view name);
+// adds a member at its place in order and returns the pack, which may
+// have moved. NULL is an empty pack.
+ZPack *zpack_insert(ZPack *pack, double score, std::string_view name);
+void zpack_erase(ZPack *pack, uint32_t i);
+void zpack_free(ZPack *pack);
@@ -1,88 +1,182 @@
+#include <math.h>
+#include <algorithm>
 #include <functional>
+#include <vector>
 #include <cassert>
 #include <cstring>
+#include <new>
 
 #include "zset.h"
 #include "common.h"
 
-ZNode::ZNode(std::string name, double score)
-    : score(score), name(std::move(name)) {
-    avl_init(&tree);
-    hmap.next = nullptr;
-    hmap.hashcode = str_hash(reinterpret_cast<const uint8_t *>(this->name.data()), this->name.size());
+// no less than the object, whose tail padding the name may not cover
+size_t ZNode::allocSize(size_t len) {
+    return std::max(sizeof(ZNode), offsetof(ZNode, name) + len);
 }
 
-ZSet::ZSet() = default;
+ZNode *ZNode::create(std::string_view name, double score) {
+    ZNode *node = new (slab_alloc(allocSize(name.size()))) ZNode();
+    avl_init(&node->tree);
+    node->score = score;
+    node->len = (uint32_t)name.size();
+    memcpy(node->name, name.data(), name.size());
+    return node;
+}
+
+void ZNode::destroy(ZNode *node) {
+    size_t size = allocSize(node->len);
+    node->~ZNode();
+    slab_free(node, size);
+}
+
+ZSet::ZSet(ZIndex index) : index(index) {}
 
 ZSet::~ZSet() {
     clear();
 }
 
-bool ZSet::add(const std::string &name, double score) {
-    ZNode *existingNode = lookup(name);
+bool ZSet::add(std::string_view name, double score) {
+    if (packed) {
+        int32_t i = zpack_find(pack, name);
+        if (i >= 0 && zpack_score(pack, (uint32_t)i) == score) {
+            return false;
+        }
+        if (i >= 0) {
+            zpack_erase(pack, (uint32_t)i);
+            pack = zpack_insert(pack, score, name);
+            return false;
+        }
+        if (size() < k_zpack_max_members && name.size() <= k_zpack_max_name) {
+            pack = zpack_insert(pack, score, name);
+            return true;
+        }
+        unpack();
+    }
+
+    ZNode *existingNode = hmap.find(name);
     if (existingNode) {
         update(existingNode, score);
         return false;
     }
 
-    auto node = std::make_unique<ZNode>(name, score);
-    hmap.insert(&node->hmap);
-    addToTree(std::move(node));
+    ZNode *node = ZNode::create(name, score);
+    hmap.insert(node);
+    addToTree(node);
     return true;
 }
 
-static bool hashNodeCompare(HashNode *node, HashNode *key) {
-    ZNode *znode = container_of(node, ZNode, hmap);
-    HKey *hkey = container_of(key, HKey, node);
-    return znode->name == std::string(hkey->name, hkey->len);
-}
+void ZSet::addNew(std::vector<ZPair> &pairs) {
+    std::sort(pairs.begin(), pairs.end(), [](const ZPair &a, const ZPair &b) {
+        return a.score != b.score ? a.score < b.score : a.name < b.name;
+    });
+    if (packed) {
+        bool fits = size() + pairs.size() <= k_zpack_max_members;
+        for (size_t i = 0; fits && i < pairs.size(); ++i) {
+            fits = pairs[i].name.size() <= k_zpack_max_name;
+        }
+        if (fits) {
+            for (const ZPair &p : pairs) {
+                pack = zpack_insert(pack, p.score, p.name);
+            }
+            return;
+        }
+        unpack();
+    }
 
-ZNode *ZSet::lookup(const std::string &name)  {  // removed const
-    if (!tree) return nullptr;
+    if (pairs.size() * 4 < size()) {
+        for (const ZPair &p : pairs) {
+            ZNode *node = ZNode::create(p.name, p.score);
+            hmap.insert(node);
+            addToTree(node);
+        }
+        return;
+    }
 
-    HKey key;
-    key.node.hashcode = str_hash(reinterpret_cast<const uint8_t *>(name.data()), name.size());
-    key.name = name.data();
-    key.len = name.size();
+    // merge the members in order with the batch, then build on that
+    std::vector<ZNode *> nodes;
+    nodes.reserve(size() + pairs.size());
+    ZIter it = seek(-INFINITY, "");
+    for (const ZPair &p : pairs) {
+        while (it.valid() && (it.node->score < p.score
+            || (it.node->score == p.score && it.node->getName() < p.name)))
+        {
+            nodes.push_back(it.node);
+            advance(it, +1);
+        }
+        ZNode *node = ZNode::create(p.name, p.score);
+        hmap.insert(node);
+        nodes.push_back(node);
+    }
+    for (; it.valid(); advance(it, +1)) {
+        nodes.push_back(it.node);
+    }
 
-    HashNode *found = hmap.search(&key.node, &hashNodeCompare);
-    return found ? container_of(found, ZNode, hmap) : nullptr;
+    if (index == ZINDEX_BTREE) {
+        btree.clear();
+        btree.build(nodes.data(), nodes.size());
+        return;
+    }
+    std::vector<AVLNode *> links(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        links[i] = &nodes[i]->tree;
+    }
+    tree = avl_build(links.data(), links.size());
 }
 
+bool ZSet::lookup(std::string_view name, double &score) {
+    if (packed) {
+        int32_t i = zpack_find(pack, name);
+        if (i < 0) return false;
+        score = zpack_score(pack, (uint32_t)i);
+        return true;
+    }
+    ZNode *node = hmap.find(name);
+    if (!node) return false;
+    score = node->score;
+    return true;
+}
 
+bool ZSet::remove(std::string_view name) {
+    if (packed) {
+        int32_t i = zpack_find(pack, name);
+        if (i < 0) return false;
+        zpack_erase(pack, (uint32_t)i);
+        return true;
+    }
+    ZNode *node = hmap.erase(name);
+    if (!node) return false;
 
-std::unique_ptr<ZNode> ZSet::pop(const std::string &name) {
-    if (!tree) return nullptr;
-
-    HKey key;
-    key.node.hashcode = str_hash(reinterpret_cast<const uint8_t *>(name.data()), name.size());
-
-    key.name = name.data();
-    key.len = name.length();
-
-
-    HashNode *found = hmap.erase(&key.node, [](HashNode *node, HashNode *key) {
-        ZNode *znode = container_of(node, ZNode, hmap);
-        HKey *hkey = container_of(key,HKey,node);
-        return znode->name == hkey->name; 
-    });
-
-    if (!found) return nullptr;
-
-    ZNode *node = container_of(found, ZNode, hmap);
     removeFromTree(node);
+    ZNode::destroy(node);
+    return true;
+}
 
-    // Return ownership of the node
-    return std::unique_ptr<ZNode>(node);
+size_t ZSet::size() const {
+    if (packed) {
+        return pack ? pack->n : 0;
+    }
+    return hmap.size();
 }
 
-ZNode *ZSet::query(double score, const std::string &name) const {
+ZIter ZSet::seek(double score, std::string_view name) const {
+    ZIter it;
+    if (packed) {
+        it.slot = zpack_lower(pack, score, name);
+        it.pack = pack && it.slot < pack->n ? pack : nullptr;
+        return it;
+    }
+    if (index == ZINDEX_BTREE) {
+        it.pos = btree.lowerBound(score, name);
+        it.node = BTree::at(it.pos);
+        return it;
+    }
+
     AVLNode *found = nullptr;
     AVLNode *cur = tree;
 
     while (cur) {
         ZNode *currentNode = container_of(cur, ZNode, tree);
-        if (currentNode->score < score || (currentNode->score == score && currentNode->name < name)) {
+        if (currentNode->score < score || (currentNode->score == score && currentNode->getName() < name)) {
             cur = cur->right;
         } else {
             found = cur;
@@ -90,37 +184,115 @@ ZNode *ZSet::query(double score, const std::string &name) const {
         }
     }
 
-    return found ? container_of(found, ZNode, tree) : nullptr;
+    it.node = found ? container_of(found, ZNode, tree) : nullptr;
+    return it;
+}
+
+void ZSet::advance(ZIter &it, int64_t offset) const {
+    if (packed) {
+        if (!it.pack) return;
+        int64_t slot = (int64_t)it.slot + offset;
+        if (slot >= 0 && slot < (int64_t)pack->n) {
+            it.slot = (uint32_t)slot;
+        } else {
+            it.pack = nullptr;
+        }
+        return;
+    }
+    if (index == ZINDEX_BTREE) {
+        btree.advance(it.pos, offset);
+        it.node = BTree::at(it.pos);
+        return;
+    }
+    if (!it.node) return;
+
+    AVLNode *avlNode = nullptr;
+    if (offset == 1) {
+        avlNode = avl_next(&it.node->tree);
+    } else if (offset == -1) {
+        avlNode = avl_prev(&it.node->tree);
+    } else {
+        avlNode = avl_offset(&it.node->tree, offset);
+    }
+    it.node = avlNode ? container_of(avlNode, ZNode, tree) : nullptr;
+}
+
+ZIter ZSet::select(uint64_t rank) const {
+    ZIter it;
+    if (rank >= size()) {
+        return it;
+    }
+    if (packed) {
+        it.pack = pack;
+        it.slot = (uint32_t)rank;
+    } else if (index == ZINDEX_BTREE) {
+        it.pos = btree.select(rank);
+        it.node = BTree::at(it.pos);
+    } else {
+        // the root has as many before it as its left subtree holds
+        int64_t root = tree->left ? tree->left->cnt : 0;
+        AVLNode *found = avl_offset(tree, (int64_t)rank - root);
+        it.node = container_of(found, ZNode, tree);
+    }
+    return it;
+}
+
+uint64_t ZSet::rank(const ZIter &it) const {
+    if (!it.valid()) {
+        return size();
+    }
+    if (packed) {
+        return it.slot;
+    }
+    if (index == ZINDEX_BTREE) {
+        return it.pos.rank;
+    }
+    return avl_rank(&it.node->tree);
 }
 
 void ZSet::clear() {
+    if (packed) {
+        zpack_free(pack);
+        pack = nullptr;
+        return;
+    }
+    if (index == ZINDEX_BTREE) {
+        for (ZIter it = seek(-INFINITY, ""); it.node; ) {
+            ZNode *node = it.node;
+            advance(it, +1);
+            ZNode::destroy(node);
+        }
+        btree.clear();
+        hmap.clear();
+        return;
+    }
     if (!tree) return;
 
     std::function<void(AVLNode *)> dispose = [&](AVLNode *node) {
         if (!node) return;
         dispose(node->left);
         dispose(node->right);
-        delete container_of(node, ZNode, tree);
+        ZNode::destroy(container_of(node, ZNode, tree));
     };
 
     dispose(tree);
     tree = nullptr;
-    hmap.freeUp(); // clear()
+    hmap.clear();
 }
 
 
-static bool zless(AVLNode *lhs, double score, const std::string &name) {
+static bool zless(AVLNode *lhs, double score, std::string_view name) {
     ZNode *zl = container_of(lhs, ZNode, tree);
     if (zl->score != score) {
         return zl->score < score;
     }
-    int rv = zl->name.compare(name);
+    int rv = zl->getName().compare(name);
     return rv < 0;
 }
 
 static bool zless(AVLNode *lhs, AVLNode *rhs) {
     ZNode *zr = container_of(rhs, ZNode, tree);
-    return zless(lhs, zr->score, zr->name);
+    return zless(lhs, zr->score, zr->getName());
 }
 
 void ZSet::update(ZNode *node, double new_score) {
@@ -129,10 +301,15 @@ void ZSet::update(ZNode *node, double new_score) {
     removeFromTree(node);
     node->score = new_score;
     avl_init(&node->tree);
-    addToTree(std::unique_ptr<ZNode>(node));
+    addToTree(node);
 }
 
-void ZSet::addToTree(std::unique_ptr<ZNode> node) {
+void ZSet::addToTree(ZNode *node) {
+    if (index == ZINDEX_BTREE) {
+        btree.insert(node);
+        return;
+    }
+
     AVLNode *cur = nullptr;
     AVLNode **from = &tree;
 
@@ -144,18 +321,48 @@ void ZSet::addToTree(std::unique_ptr<ZNode> node) {
     *from = &node->tree;
     node->tree.parent = cur;
     tree = avl_fix(&node->tree);
-
-    // Transfer ownership to the tree
-    node.release();
 }
 
 void ZSet::removeFromTree(ZNode *node) {
+    if (index == ZINDEX_BTREE) {
+        btree.erase(node);
+        return;
+    }
+
     tree = avl_del(&node->tree);
 }
 
-ZNode* ZSet::offset(ZNode* node, int64_t offset) const {
-    if (!node) return nullptr;
+void ZSet::unpack() {
+    assert(packed);
+    packed = false;
+    for (uint32_t i = 0; pack && i < pack->n; ++i) {
+        ZNode *node = ZNode::create(zpack_name(pack, i), zpack_score(pack, i));
+        hmap.insert(node);
+        addToTree(node);
+    }
+    zpack_free(pack);
+    pack = nullptr;
+}
+
+void ZSet::setIndex(ZIndex to) {
+    if (packed) {
+        index = to;
+        unpack();
+        return;
+    }
+    if (to == index) return;
 
-    AVLNode* avlNode = avl_offset(&node->tree, offset);
-    return avlNode ? container_of(avlNode, ZNode, tree) : nullptr;
+    // in order, then into the other index
+    std::vector<ZNode *> nodes;
+    nodes.reserve(hmap.size());
+    for (ZIter it = seek(-INFINITY, ""); it.node; advance(it, +1)) {
+        nodes.push_back(it.node);
+    }
+    tree = nullptr;
+    btree.clear();
+    index = to;
+    for (ZNode *node : nodes) {
+        avl_init(&node->tree);
+        addToTree(node);
+    }
 }
\ No newline at end of file
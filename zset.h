@@ -1,21 +1,20 @@
 #pragma once
 
-#include <memory>
-#include <string>
+#include <string_view>
+#include <vector>
 #include "avl.h"
-#include "hashtable.h"
-
-
-struct HKey {
-    HashNode node;
-    const char *name = nullptr;
-    size_t len = 0;
-};
+#include "btree.h"
+#include "slab.h"
+#include "swisstable.h"
+#include "zpack.h"
 
 
+// one block per member: the links and the score, then the name bytes,
+// so a lookup touches one allocation and compares in place
 class ZNode {
 public:
-    ZNode(std::string name, double score);
+    static ZNode *create(std::string_view name, double score);
+    static void destroy(ZNode *node);
 
     ZNode(const ZNode &) = delete;
     ZNode &operator=(const ZNode &) = delete;
@@ -23,36 +22,90 @@ public:
     ZNode &operator=(ZNode &&) = delete;
 
     double getScore() const { return score; }
-    const std::string &getName() const { return name; }
+    std::string_view getName() const { return std::string_view(name, len); }
+
+    AVLNode tree;       // ZINDEX_AVL only
+    HashLink hmap;
+    double score;
+    uint32_t len;
+    char name[];
+
+private:
+    ZNode() = default;
+    static size_t allocSize(size_t len);
+};
 
-    friend class ZSet;
+struct ZNodeName {
+    std::string_view operator()(const ZNode &node) const { return node.getName(); }
+};
 
-    AVLNode tree;
-    HashNode hmap;
+// what keeps a set in (score, name) order once it is too big to be
+// packed, see zpack.h
+enum ZIndex : uint8_t {
+    ZINDEX_AVL = 0,     // a tree through the nodes
+    ZINDEX_BTREE = 1,   // wide nodes of pointers, see btree.h
+};
+
+// a position in (score, name) order, valid until the set is changed
+struct ZIter {
+    ZNode *node = nullptr;          // the tree indexes, NULL past either end
+    BPos pos;                       // ZINDEX_BTREE
+    const ZPack *pack = nullptr;    // packed, NULL past either end
+    uint32_t slot = 0;
+
+    bool valid() const { return node || pack; }
+    double score() const { return node ? node->score : zpack_score(pack, slot); }
+    std::string_view name() const { return node ? node->getName() : zpack_name(pack, slot); }
+};
+
+struct ZPair {
     double score;
-    std::string name;
+    std::string_view name;
 };
 
 class ZSet {
 public:
-    ZSet();
+    explicit ZSet(ZIndex index = ZINDEX_AVL);
     ~ZSet();
 
-    bool add(const std::string &name, double score);
-    ZNode *lookup(const std::string &name); // removed const
-    std::unique_ptr<ZNode> pop(const std::string &name);
-    ZNode *query(double score, const std::string &name) const;
-    ZNode* offset(ZNode* node, int64_t offset) const;
+    bool add(std::string_view name, double score);
+    // members not in the set yet, with distinct names; `pairs` is left
+    // sorted. a batch at least a quarter the size of the set rebuilds
+    // the index from the merged order in O(n) rather than rebalancing
+    // at every insert.
+    void addNew(std::vector<ZPair> &pairs);
+    bool lookup(std::string_view name, double &score);
+    bool remove(std::string_view name);
+    size_t size() const;
+    // the first member >= (score, name)
+    ZIter seek(double score, std::string_view name) const;
+    // `offset` members on, or back if negative
+    void advance(ZIter &it, int64_t offset) const;
+    // the member with `rank` members before it
+    ZIter select(uint64_t rank) const;
+    // the members before `it`, size() if it is past the end
+    uint64_t rank(const ZIter &it) const;
     void clear();
 
+    bool isPacked() const { return packed; }
+    ZIndex getIndex() const { return index; }
+    // move the members to another kind of index, a packed set is
+    // unpacked into it
+    void setIndex(ZIndex to);
+
     ZSet(const ZSet &) = delete;
     ZSet &operator=(const ZSet &) = delete;
 
     void update(ZNode *node, double new_score);
-    void addToTree(std::unique_ptr<ZNode> node);
+    void addToTree(ZNode *node);
     void removeFromTree(ZNode *node);
+    // from the pack to a node per member, for good
+    void unpack();
 
+    bool packed = true;
+    ZPack *pack = nullptr;
+    ZIndex index;           // once unpacked
     AVLNode *tree = nullptr;
-    HashMap hmap;
+    BTree btree;
+    IntrusiveMap<ZNode, offsetof(ZNode, hmap), ZNodeName> hmap;
 };
-